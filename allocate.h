@@ -22,6 +22,10 @@
 #define RTcustom1    ((void *) 2)
 #define RTmetadata   ((void *) 3)
 
+// Values for RTuse_huge_pages, which must be set before RTinit_heap
+#define RTtransparent_huge_pages 1  // madvise(MADV_HUGEPAGE)
+#define RThugetlb_pages 2	    // MAP_HUGETLB, falling back to madvise
+
 #define RTbeerBash(lhs, rhs) ((lhs) = (rhs))
 #define setf_init(lhs, rhs) ((lhs) = (rhs))
 
@@ -31,6 +35,9 @@ typedef long RT_METADATA;
 
 void *RTallocate(void *metadata, int number_of_bytes);
 
+void RTallocate_many(void *metadata, int number_of_bytes, int count,
+		     void **objects);
+
 void *RTstatic_allocate(void *metadata, int number_of_bytes);
 
 void *RTwrite_barrier(void *lhs_address, void * rhs);
@@ -50,6 +57,8 @@ int RTpthread_create(pthread_t *thread, const pthread_attr_t *attr,
 
 int rtgc_count(void);
 
+long RTlocked_bytes();
+
 void RTfull_gc();
 
 void RTregister_root_scanner(void (*root_scanner)());
@@ -67,5 +76,24 @@ struct timespec RTtime_diff(struct timespec start, struct timespec end);
 int RTtime_cmp(struct timespec x, struct timespec y);
 
 extern volatile int RTatomic_gc;
+extern size_t RTheap_reserve_bytes;
+extern int RTrelease_min_pages;
+extern int RTrelease_age;
+extern int RTrelease_use_madv_free;
+extern int RTuse_huge_pages;
+// log2 of the gc's page size, from OS_PAGE_POWER to MAX_PAGE_POWER.
+// Must be set before RTinit_heap, which sets RTpage_size from it.
 extern int RTpage_power;
 extern int RTpage_size;
+// How many NUMA nodes get their own fresh regions, at most
+// MAX_NUMA_NODES. 0, the default, uses the nodes the kernel has online.
+// Must be set before RTinit_heap.
+extern int RTnuma_nodes;
+// Set before RTinit_heap to fault in and mlock the heap, the gc's page
+// tables and write vector, and the buffers flips copy stacks into, as
+// they're committed. Idle holes are never released while it's set.
+extern int RTlock_memory;
+// How many threads mark, the gc thread included, at most
+// MAX_MARKER_THREADS. 1, the default, marks on the gc thread alone and
+// 0 uses one per online cpu. Must be set before RTinit_heap.
+extern int RTmarker_threads;
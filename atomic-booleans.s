@@ -31,6 +31,46 @@ locked_long_and:
 locked_long_inc:
 	lock addq	$1, (%rdi)
 	ret
+
+	.align	8
+	.global locked_long_dec
+locked_long_dec:
+	lock subq	$1, (%rdi)
+	ret
+
+# Keeps a store from passing a later load
+	.align	8
+	.global memory_fence
+memory_fence:
+	mfence
+	ret
+
+# Stores y in *x, returns the old *x
+	.align	8
+	.global locked_long_xchg
+locked_long_xchg:
+	movq	%rsi, %rax
+	xchgq	%rax, (%rdi)
+	ret
+
+# Sets bit y of *x, returns 1 if it was already set, else 0
+	.align	8
+	.global locked_long_bts
+locked_long_bts:
+	lock btsq	%rsi, (%rdi)
+	setc	%al
+	movzbl	%al, %eax
+	ret
+
+# Returns 1 if *x was old_value and is now new_value, else 0
+	.align	8
+	.global locked_long_cas
+locked_long_cas:
+	movq	%rsi, %rax
+	lock cmpxchgq	%rdx, (%rdi)
+	sete	%al
+	movzbl	%al, %eax
+	ret
 	
 	.align 8
 .globl locked_byte_or
@@ -46,6 +46,12 @@ typedef GC_HEADER *GCPTR;
 #define GET_COLOR(p) (GET_LINK_INFO(p->prev,GC_COLOR_INFO_MASK))
 #define SET_COLOR(p,color) (SET_LINK_INFO(p->prev,GC_COLOR_INFO_MASK,color))
 
+// Set by the gc on garbage whose body it has already zeroed
+#define GC_ZEROED_INFO_MASK (0x4)
+#define ZEROEDP(p) (0 != GET_LINK_INFO(p->next, GC_ZEROED_INFO_MASK))
+#define SET_ZEROED(p) (SET_LINK_INFO(p->next,GC_ZEROED_INFO_MASK,GC_ZEROED_INFO_MASK))
+#define CLEAR_ZEROED(p) (SET_LINK_INFO(p->next,GC_ZEROED_INFO_MASK,0))
+
 // use enums for these instead?
 #define SC_NOPOINTERS     0
 #define SC_POINTERS       1
@@ -19,18 +19,46 @@
 
 // HEY! get rid of max_segments?
 #define MAX_HEAP_SEGMENTS 1
-#define MAX_STATIC_SEGMENTS 1
+#define MAX_STATIC_SEGMENTS 16
 #define MAX_SEGMENTS MAX_HEAP_SEGMENTS + MAX_STATIC_SEGMENTS
 #define MAX_THREADS 20
 #define MAX_GLOBAL_ROOTS 1000
 
 // The heap is divided into multiple segments
 #define DEFAULT_HEAP_SEGMENT_SIZE 1 << 20
-#define DEFAULT_STATIC_SEGMENT_SIZE 0     /* only 1 static segment for now */
+// The heap segment reserves RTheap_reserve_bytes of address space and
+// commits the RTinit_heap size of it up front. At the end of a cycle
+// the gc commits another HEAP_GROW_PERCENT of the heap if an allocator
+// ran out of pages, or if occupancy stayed above
+// HEAP_GROW_OCCUPANCY_PERCENT for HEAP_GROW_CYCLES collections in a row.
+#define DEFAULT_HEAP_RESERVE_BYTES (1L << 36)
+#define HEAP_GROW_PERCENT 50
+#define HEAP_GROW_OCCUPANCY_PERCENT 75
+#define HEAP_GROW_CYCLES 4
+// Holes of at least RTrelease_min_pages pages that stay empty for
+// RTrelease_age collections are given back to the kernel with madvise,
+// all but the OS page holding the hole header. They come back
+// zero filled when they're reused. RTrelease_min_pages 0 turns it off.
+#define DEFAULT_RELEASE_MIN_PAGES 16
+#define DEFAULT_RELEASE_AGE 4
+// With RTuse_huge_pages set the heap and its page table and write
+// vector are reserved and committed in huge page sized pieces, so the
+// marker's scattered accesses don't thrash the TLB.
+#define HUGE_PAGE_POWER 21     /* x86_64 huge pages are 2MB */
+// When the static segment fills another one twice its size is chained
+// on, bigger still if the object needs it. The first is the RTinit_heap
+// static size, or this if that was 0.
+#define DEFAULT_STATIC_SEGMENT_SIZE (1 << 20)
 #define CHECK_BASH 0
 #define CHECK_SETFINIT 1
 #define GC_POINTER_ALIGNMENT (sizeof(long *))
-#define PAGE_POWER 12	       /* x86_64 page size is normally 4096 */
+#define OS_PAGE_POWER 12	       /* x86_64 page size is normally 4096 */
+// The gc's own page size is 1 << RTpage_power, set before RTinit_heap.
+// Bigger pages mean a smaller page table and less work for the
+// coalescer, but more space lost at the ends of runs and large objects.
+// RTrelease_min_pages counts these pages, not the OS's.
+#define PAGE_POWER 12
+#define MAX_PAGE_POWER 16
 //#define INTERIOR_PTR_RETENTION_LIMIT 32
 #define INTERIOR_PTR_RETENTION_LIMIT 512
 
@@ -38,6 +66,104 @@
 #define DETECT_INVALID_REFS 0
 #define USE_BIT_WRITE_BARRIER 1
 
+// A summary bit per RTwrite_vector word that may be nonzero, so each
+// pass of the mark loop only reads the parts of the write vector the
+// barrier has touched. Needs USE_BIT_WRITE_BARRIER.
+#define USE_WRITE_VECTOR_SUMMARY 1
+
+// Per-thread allocation caches. Each mutator thread grabs a batch of
+// objects per group under the group free_lock and then allocates from
+// the batch without locking.
+#define USE_THREAD_CACHES 1
+#define THREAD_CACHE_SIZE 32		   /* max objects cached per group */
+#define THREAD_CACHE_MAX_OBJECT_SIZE 1024  /* bigger objects aren't cached */
+
+// RTallocate_many takes at most this many objects per free_lock hold,
+// so a big batch can't keep a flip waiting.
+#define ALLOCATE_MANY_CHUNK_SIZE 32
+
+// The gc zeroes garbage in groups of at least PREZERO_MIN_OBJECT_SIZE
+// bytes when it recycles it, so allocation can skip the memset.
+// Objects of PREZERO_NONTEMPORAL_SIZE and up are zeroed with streaming
+// stores so they don't flush the gc's cache.
+#define USE_GC_PREZEROING 1
+#define PREZERO_MIN_OBJECT_SIZE 512
+#define PREZERO_NONTEMPORAL_SIZE 4096
+
+// Pointer objects in groups of EXACT_SIZE_MIN_OBJECT_SIZE bytes and up
+// record their requested size in their last word. The gc only scans,
+// and allocation only zeroes, that much of the body.
+#define USE_EXACT_OBJECT_SIZE 1
+#define EXACT_SIZE_MIN_OBJECT_SIZE 1024
+
+// Groups that run out of fresh pages more than once per gc cycle get
+// twice as many runs at their next refill, up to REFILL_MAX_BYTES, and
+// groups that go a whole cycle without one get half as many.
+#define USE_ADAPTIVE_REFILL 1
+#define REFILL_MAX_BYTES (1 << 18)
+
+// Recycled objects go on the free list fullest run first, in
+// OCCUPANCY_BUCKETS bands of run occupancy. Allocation then packs the
+// dense runs and the sparse ones get a chance to empty out and go back
+// to the empty page pool.
+#define USE_DENSE_FIRST_ALLOCATION 1
+#define OCCUPANCY_BUCKETS 4
+
+// Each group has a fresh region per NUMA node, and allocators carve
+// new objects from the one for the node they're running on. A region's
+// pages are bound to its node when it's refilled. Helper markers are
+// spread over the nodes, and hand objects on other nodes' pages to
+// those nodes' markers in batches of MARK_HANDOFF_SIZE. Recycled
+// objects are kept together by node on the free list, and allocators
+// take their own node's first. MAX_NUMA_NODES 1 turns this off.
+#define MAX_NUMA_NODES 4
+#define MARK_HANDOFF_SIZE 64
+
+// Objects of LARGE_OBJECT_MIN_SIZE bytes and up get exactly the pages
+// they need from the empty page pool instead of a size class, and their
+// pages go straight back to the pool when they die.
+#define USE_LARGE_OBJECT_SPACE 1
+#define LARGE_OBJECT_MIN_SIZE (1 << 18)
+
+// Freed runs and large objects are merged into holes, and idle holes
+// released, on a low priority coalescer thread instead of the gc's.
+// COALESCER_NICE is added to the nice value of the thread that starts
+// it. It holds the empty_pages_lock for at most COALESCE_BATCH_SIZE
+// holes at a time, and never while it madvises.
+#define USE_COALESCER_THREAD 1
+#define COALESCER_NICE 10
+#define COALESCE_BATCH_SIZE 64
+
+// Marking is shared by RTmarker_threads threads, the gc thread and
+// helpers it wakes for each round. Each marker keeps its gray objects
+// on a deque of MARK_DEQUE_SIZE entries, spilling any more to a private
+// stack, and steals from the others' deques when it runs dry. Objects
+// over MARK_CHUNK_SIZE bytes are split into chunks that are stolen
+// separately.
+#define USE_PARALLEL_MARKING 1
+#define MAX_MARKER_THREADS 32
+#define MARK_DEQUE_SIZE (1 << 12)	/* must be a power of two */
+#define MARK_CHUNK_SIZE (1 << 14)
+
+// Markers prefetch the header of every heap object a scanned word
+// points at, and only check its color once MARK_PREFETCH_DISTANCE more
+// pointers have been found, by which time the header should be in
+// cache. Needs USE_PARALLEL_MARKING.
+#define USE_MARK_PREFETCH 1
+#define MARK_PREFETCH_DISTANCE 8	/* must be a power of two */
+
+// Conservative scans filter words against the partition several at a
+// time with SSE2, or AVX2 when cpuid says it's there, and only look up
+// the page table for the ones that might be heap pointers. x86_64 only.
+#define USE_SIMD_RANGE_SCAN 1
+
+// Mark state lives in side bitmaps, a bit per OBJECT_ALIGNMENT bytes of
+// heap, instead of in the color bits of object headers. Markers claim
+// objects by setting their bit, and the sweep finds the garbage by
+// scanning the bitmaps a word at a time, so the gc never writes to the
+// pages of objects that survive. Needs USE_PARALLEL_MARKING.
+#define USE_MARK_BITMAP 1
+
 #ifdef NDEBUG
 #define DEBUG(x)
 #else
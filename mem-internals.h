@@ -26,22 +26,62 @@
 typedef unsigned long * LPTR;
 typedef unsigned char * BPTR;
 
-#define BYTES_PER_PAGE (1 << PAGE_POWER)
+#define BYTES_PER_PAGE RTpage_size
 #define PAGE_ALIGNMENT_MASK (BYTES_PER_PAGE - 1)
-#define PTR_TO_PAGE_INDEX(ptr) ((long) (((BPTR) ptr - first_partition_ptr) >> PAGE_POWER))
-#define PAGE_INDEX_TO_PTR(page_index) (first_partition_ptr + ((page_index) << PAGE_POWER))
-#define PTR_TO_GROUP(ptr) pages[PTR_TO_PAGE_INDEX(ptr)].group
+#define PTR_TO_PAGE_INDEX(ptr) ((long) (((BPTR) ptr - first_partition_ptr) >> RTpage_power))
+#define PAGE_INDEX_TO_PTR(page_index) (first_partition_ptr + ((long) (page_index) << RTpage_power))
+#define PTR_TO_GROUP(ptr) PAGE_INDEX_TO_GROUP(PTR_TO_PAGE_INDEX(ptr))
 #define IN_PARTITION(ptr) (((BPTR) ptr >= first_partition_ptr) && ((BPTR) ptr < last_partition_ptr))
 #define PAGE_GROUP(ptr) (IN_PARTITION(ptr) ? PTR_TO_GROUP(ptr) : EXTERNAL_PAGE)
 #define IN_HEAP(ptr) ((long) PAGE_GROUP(ptr) > (long) EXTERNAL_PAGE)
-#define ROUND_DOWN_TO_PAGE(ptr) ((BPTR) (((long) ptr & ~PAGE_ALIGNMENT_MASK)))
-#define ROUND_UP_TO_PAGE(ptr) (ROUND_DOWN_TO_PAGE(ptr) + BYTES_PER_PAGE)
-
-#define MIN_GROUP_INDEX 5	// yields min 32 byte objects on x86_64
-#define MAX_GROUP_INDEX 24	// yields max 16 megabyte objects
-#define MIN_GROUP_SIZE (1 << MIN_GROUP_INDEX)
-#define MAX_GROUP_SIZE ( 1 << MAX_GROUP_INDEX)
+// Memory is committed, released and checked for residency in OS pages
+#define OS_PAGE_BYTES (1 << OS_PAGE_POWER)
+#define OS_PAGE_ALIGNMENT_MASK (OS_PAGE_BYTES - 1)
+#define ROUND_DOWN_TO_OS_PAGE(ptr) ((BPTR) ((long) (ptr) & ~OS_PAGE_ALIGNMENT_MASK))
+#define ROUND_UP_TO_OS_PAGE(ptr) (ROUND_DOWN_TO_OS_PAGE(ptr) + OS_PAGE_BYTES)
+#define HUGE_PAGE_BYTES (1L << HUGE_PAGE_POWER)
+#define HUGE_PAGE_ALIGNMENT_MASK (HUGE_PAGE_BYTES - 1)
+#define ROUND_UP_TO_HUGE_PAGE(n) \
+  (((long) (n) + HUGE_PAGE_ALIGNMENT_MASK) & ~HUGE_PAGE_ALIGNMENT_MASK)
+#define ROUND_DOWN_TO_HUGE_PAGE(n) ((long) (n) & ~HUGE_PAGE_ALIGNMENT_MASK)
+
+// Groups are size classes. Sizes are multiples of OBJECT_ALIGNMENT:
+// 32, 48 and 64 bytes, then GROUP_SUBCLASSES classes per power of two
+// (80, 96, 112, 128, 160, ...), so each class is at most 1.25x the
+// previous one.
+#define OBJECT_ALIGNMENT_POWER 4	// link info bits need 16 byte alignment
+#define OBJECT_ALIGNMENT (1 << OBJECT_ALIGNMENT_POWER)
+#define MIN_GROUP_POWER 5	// yields min 32 byte objects on x86_64
+#define MAX_GROUP_POWER 24	// yields max 16 megabyte objects
+#define GROUP_SUBCLASS_BITS 2
+#define GROUP_SUBCLASSES (1 << GROUP_SUBCLASS_BITS)
+#define MIN_GROUP_SIZE (1 << MIN_GROUP_POWER)
+#define MAX_GROUP_SIZE (1 << MAX_GROUP_POWER)
+#define FIRST_SUBCLASS_GROUP_INDEX 3	// after the 32, 48 and 64 byte groups
+#define MIN_GROUP_INDEX 0
+#define MAX_GROUP_INDEX (FIRST_SUBCLASS_GROUP_INDEX - 1 + \
+			 (GROUP_SUBCLASSES * \
+			  (MAX_GROUP_POWER - MIN_GROUP_POWER - 1)))
 #define NUMBER_OF_GROUPS (MAX_GROUP_INDEX - MIN_GROUP_INDEX + 1)
+// The large object space is a pseudo group after the size classes. It
+// has a treadmill for marking, but no free list, runs or fresh region.
+#if USE_LARGE_OBJECT_SPACE
+#define LARGE_GROUP_INDEX (MAX_GROUP_INDEX + 1)
+#define LAST_GROUP_INDEX LARGE_GROUP_INDEX
+#define LARGE_GROUP (groups + LARGE_GROUP_INDEX)
+// A large object starts LARGE_OBJECT_PREFIX_SIZE bytes into its first
+// page. The prefix holds the object size, header included.
+#define LARGE_OBJECT_PREFIX_SIZE 16
+#define LARGE_OBJECT_SIZE(gcptr) (((long *) (gcptr))[-2])
+#define LARGE_OBJECT_PAGES(object_size) \
+  (((object_size) + LARGE_OBJECT_PREFIX_SIZE + BYTES_PER_PAGE - 1) / \
+   BYTES_PER_PAGE)
+#else
+#define LAST_GROUP_INDEX MAX_GROUP_INDEX
+#endif
+// Interior pointer to object index within a run is a multiply and shift
+// instead of a divide. Exact as long as run bytes * size < 2^40.
+#define SIZE_RECIPROCAL_SHIFT 40
 #define LONG_ALIGNMENT (sizeof(long) - 1)
 #define ROUND_UPTO_LONG_ALIGNMENT(n) (((((n) - 1)) & ~LONG_ALIGNMENT) + \
                                      sizeof(long)) 
@@ -55,52 +95,163 @@ typedef unsigned char * BPTR;
 #define MAX(x,y) ((x > y) ? x : y)
 #define SWAP(x,y) {int tmp = x; x = y; y = tmp;}
 
+// Objects are carved out of runs of run_pages pages. A run holds
+// run_objects objects laid out from the start of the run, and never
+// more than an eighth of a run is left over at the end.
+typedef struct fresh_region {
+  BPTR fresh;			// next uncarved object in the region
+  BPTR fresh_limit;		// end of the region
+  volatile unsigned long version; // odd while a refill moves the region
+} FRESH_REGION;
+
+// Keeps the compiler from moving loads and stores across it. x86
+// doesn't reorder loads with loads or stores with stores, so this is
+// all a reader or writer of a FRESH_REGION version needs.
+#define COMPILER_BARRIER() __asm__ __volatile__("" ::: "memory")
+
+#define REGION_EMPTY(region) ((region)->fresh == (region)->fresh_limit)
+
 typedef struct group_info {
   int size;
   int index;
+  int run_pages;
+  int run_objects;
+  unsigned long size_reciprocal;
 
   GCPTR last;			// used in rtgc and rtalloc
   GCPTR free;			// used in rtgc and rtalloc
   GCPTR gray;			// only used in rtgc
   GCPTR black;			// only used in rtgc and rtalloc
   GCPTR white;			// only used in rtgc
+  FRESH_REGION regions[MAX_NUMA_NODES];	// fresh region for each node
+  // With more than one node, each node's free objects are kept together
+  // on the free list, from node_free to node_last
+  GCPTR node_free[MAX_NUMA_NODES];	// used in rtgc and rtalloc
+  GCPTR node_last[MAX_NUMA_NODES];	// used in rtgc and rtalloc
 
   int white_count;		// only used in rtgc
   int black_scanned_count;	// used in rtgc
   int black_alloc_count;        // used in rtgc and rtalloc
 
+  int refill_runs;		// runs the next refill asks for
+  long last_refill_gc;		// gc_count at the last refill
+  long refill_count;		// refills so far, for RTroom
+  long refill_page_count;	// pages they added, for RTroom
+
   pthread_mutex_t free_lock;	// used in rtgc and rtalloc
   pthread_mutex_t black_and_last_lock;	// used in rtgc and rtalloc
+#if USE_PARALLEL_MARKING
+  pthread_mutex_t gray_lock;	// white and gray links, only used in rtgc
+#endif
 } GROUP_INFO;
 
 typedef GROUP_INFO *GPTR;
 
+// Objects at or above a fresh pointer haven't been carved yet, so their
+// headers are whatever bits were left on the page.
+#if USE_EXACT_OBJECT_SIZE
+#define EXACT_SIZE_GROUP(group) ((group)->size >= EXACT_SIZE_MIN_OBJECT_SIZE)
+#define EXACT_SIZE_CLASS(sc) (((sc) == SC_POINTERS) || ((sc) == SC_CUSTOM1))
+#define OBJECT_SIZE_WORD(gcptr, group) \
+  ((LPTR) ((BPTR) (gcptr) + (group)->size) - 1)
+#endif
+
+#define CARVED_OBJECT(gcptr, group) carved_object((BPTR) (gcptr), (group))
+
 typedef struct segment {
   BPTR first_segment_ptr;
   BPTR last_segment_ptr;
   int segment_page_count;
   int type;
+  BPTR frontier_ptr;		// static segments, end of the objects
+  BPTR flip_frontier_ptr;	// frontier_ptr when the last flip stopped
+				// the mutators
 } SEGMENT;
 
+// Runs of empty pages. The header lives in the first page, and the
+// page table entries for the first and last pages point back at it, so
+// a newly freed neighbor can find and merge with it right away.
+// Pages outside unreleased_first .. unreleased_end, counted from the
+// header's page, have been given to the kernel, except the header's
+// own OS page. Merging holes widens the span to cover both holes'
+// unreleased pages, so it can take in some released ones too.
 typedef struct hole {
   long page_count;		// only used in rtalloc
   struct hole *next;		// only used in rtalloc
+  struct hole *prev;		// only used in rtalloc
+  long empty_since;		// gc_count when the pages were last in use
+  long unreleased_first;
+  long unreleased_end;		// equal to unreleased_first when none are
 } HOLE;
 
 typedef HOLE *HOLE_PTR;
 
+// Holes are binned by page count the way groups are, 1, 2 and 3 pages,
+// then HOLE_BIN_SUBCLASSES bins per power of two. A bit per bin says
+// whether it's empty, and empty_bin_oldest lets release_idle_holes skip
+// bins with nothing that's been empty long enough.
+#define HOLE_BIN_SUBCLASS_BITS 2
+#define HOLE_BIN_SUBCLASSES (1 << HOLE_BIN_SUBCLASS_BITS)
+#define HOLE_BINS 256
+#define HOLE_BIN_WORDS (HOLE_BINS / BITS_PER_LONG)
+
+// The page table is two bytes a page so the pointer filters in the
+// scanners stay in cache. group_id indexes page_group_table, which maps
+// ids below FIRST_GROUP_ID to EMPTY_PAGE .. EXTERNAL_PAGE and the rest
+// to groups. Runs of more than one object find their first page from
+// run_offset. Single object runs, large objects included, don't fit in
+// a byte, so their pages keep the object in page_bases instead, as do
+// the first and last pages of holes.
 typedef struct page_info {
-  GCPTR base;
-  GPTR group;
+  unsigned char group_id;
+  unsigned char run_offset;	// pages back to the start of the run
+  unsigned char node;		// NUMA node the page should be on
 } PAGE_INFO;
 
+#define FIRST_GROUP_ID 4
+#define GROUP_IDS 256
+#define MAX_RUN_OFFSET 255
+#define GROUP_ID(group) (((group) > EXTERNAL_PAGE) ? \
+			 ((group)->index + FIRST_GROUP_ID) : (long) (group))
+#define PAGE_INDEX_TO_GROUP(page_index) \
+  page_group_table[pages[page_index].group_id]
+#define SET_PAGE_GROUP(page_index, group) \
+  (pages[page_index].group_id = GROUP_ID(group))
+#define PAGE_INDEX_TO_RUN_BASE(page_index, group) \
+  (((group)->size_reciprocal == 0) ? page_bases[page_index] : \
+   (GCPTR) PAGE_INDEX_TO_PTR((page_index) - pages[page_index].run_offset))
+// An object's header is always on the first page of a single object run
+#define PTR_TO_RUN_PAGE_INDEX(ptr) \
+  (PTR_TO_PAGE_INDEX(ptr) - pages[PTR_TO_PAGE_INDEX(ptr)].run_offset)
+
+// run_live_counts holds, at each run's first page, how many of the run's
+// carved objects aren't green. It only changes under the group's
+// free_lock. A run whose count drops to zero goes on dead_runs for the
+// coalescer, and DEAD_RUN_QUEUED keeps it from going on twice.
+#define DEAD_RUN_QUEUED (1 << 30)
+#define RUN_LIVE_COUNT(page_index) \
+  (run_live_counts[page_index] & (DEAD_RUN_QUEUED - 1))
+
 typedef PAGE_INFO *PPTR;
 
 typedef struct thread_state {
   gregset_t registers;		// NREG is 23 on x86_64
   char *saved_stack_base;	// This is the LOWEST addressable byte
   int saved_stack_size;
+  GCPTR *saved_cache_objects;	// thread cache contents copied at flip
+  int saved_cache_count;
 } THREAD_STATE;
+
+// Objects in a thread cache are already allocated black and have their
+// storage class and metadata initialized for the cache's metadata.
+// The flip signal handler copies them into the THREAD_STATE so they are
+// roots for the cycle. count and objects are volatile because the
+// handler runs on the thread that owns the cache.
+typedef struct thread_cache {
+  void *metadata;
+  volatile int count;
+  GCPTR volatile objects[THREAD_CACHE_SIZE];
+} THREAD_CACHE;
   
 typedef struct thread_info {
   pthread_t pthread;
@@ -112,12 +263,26 @@ typedef struct thread_info {
 
   struct timeval max_pause_tv, total_pause_tv;
   struct thread_info *next;
+#if USE_THREAD_CACHES
+  THREAD_CACHE caches[MAX_GROUP_INDEX + 1];
+#endif
   // These fields are only used at thread startup time
   void *(*start_func) (void *);
   char *args;
   volatile long started;
 } THREAD_INFO;
 
+#if USE_PARALLEL_MARKING
+// Gray work on a marker's deque. A whole object when high is NULL,
+// otherwise a chunk of one, where md is the metadata for a chunk of
+// an SC_METADATA object and NULL for SC_POINTERS.
+typedef struct mark_entry {
+  BPTR low;
+  BPTR high;
+  long *md;
+} MARK_ENTRY;
+#endif
+
 typedef struct counter {
   int count;
   pthread_mutex_t lock;
@@ -126,6 +291,8 @@ typedef struct counter {
 
 void scan_object(GCPTR ptr, int total_size);
 void RTinit_empty_pages(int first_page, int page_count, int type);
+int hole_bin(long page_count);
+int first_hole_bin(int bin);
 void rtgc_loop();
 void init_signals_for_rtgc();
 void lock_all_free_locks();
@@ -135,6 +302,15 @@ void RTroom();
 void init_realtime_gc(void);
 void Debugger(char *msg);
 void *RTbig_malloc(size_t size);
+void *RTreserve_memory(size_t size);
+long RTresident_bytes(void *ptr, size_t size);
+int RTcommit_memory(void *ptr, size_t size);
+int RTcommit_heap_memory(void *ptr, size_t size);
+int RTonline_numa_nodes();
+int RTcurrent_numa_node();
+void RTbind_to_numa_node(void *ptr, size_t bytes, int node);
+int RTbind_thread_to_numa_node(int node);
+void maybe_grow_heap(long recycled_bytes);
 void RTcopy_regs_to_stack(BPTR regptr);
 void out_of_memory(char *space_name, int size);
 void register_global_root(void *root);
@@ -146,21 +322,50 @@ void locked_byte_or(unsigned char *x, unsigned char y);
 void locked_long_or(unsigned long *x, unsigned long y);
 void locked_long_and(unsigned long *x, unsigned long y);
 void locked_long_inc(volatile unsigned long *x);
+int locked_long_cas(volatile long *x, long old_value, long new_value);
+int locked_long_bts(unsigned long *x, long bit);
+unsigned long locked_long_xchg(unsigned long *x, unsigned long y);
 void coalesce_all_free_pages();
+void queue_dead_run(long page);
+void add_free_pages(int first_page, int page_count);
+void add_empty_pages(int first_page, int page_count);
+void take_hole(HOLE_PTR hole);
+void return_hole(HOLE_PTR hole);
+void init_coalescer();
+void locked_long_dec(volatile unsigned long *x);
+void memory_fence();
+#if USE_PARALLEL_MARKING
+void init_markers();
+void push_mark_entry(BPTR low, BPTR high, long *md);
+long run_mark_round(long (*seed)(int marker, int count));
+long take_marked_bytes();
+long scan_mark_entry(MARK_ENTRY *entry);
+#endif
+#if USE_MARK_PREFETCH
+int flush_mark_prefetch();
+#endif
+#if USE_SIMD_RANGE_SCAN
+long count_partition_words(BPTR low, BPTR high, int kernel);
+#endif
 
 extern BPTR first_partition_ptr;
 extern BPTR last_partition_ptr;
-extern BPTR first_static_ptr;
-extern BPTR last_static_ptr;
-extern BPTR static_frontier_ptr;
+extern volatile int current_static_segment;
 
 extern GROUP_INFO *groups;
 extern PAGE_INFO *pages;
-extern HOLE_PTR empty_pages;
+extern GCPTR *page_bases;
+extern int *run_live_counts;
+extern int *dead_runs;
+extern GPTR page_group_table[GROUP_IDS];
+extern HOLE_PTR empty_pages[HOLE_BINS];
+extern unsigned long empty_bin_bits[HOLE_BIN_WORDS];
+extern long empty_bin_oldest[HOLE_BINS];
+extern long empty_page_count;
 extern volatile long gc_count;
 
 extern SEGMENT *segments;
-extern int total_segments;
+extern volatile int total_segments;
 
 extern THREAD_INFO *threads;
 extern THREAD_INFO *live_threads;
@@ -188,14 +393,104 @@ extern volatile int run_gc;
 
 #if USE_BIT_WRITE_BARRIER
 extern LPTR RTwrite_vector;
+#define WRITE_VECTOR_BYTES_PER_PAGE \
+  (BYTES_PER_PAGE / (OBJECT_ALIGNMENT * BITS_PER_BYTE))
 #else
 extern BPTR RTwrite_vector;
+#define WRITE_VECTOR_BYTES_PER_PAGE (BYTES_PER_PAGE / OBJECT_ALIGNMENT)
 #endif
 extern size_t RTwrite_vector_length;
+#if USE_WRITE_VECTOR_SUMMARY
+#if !USE_BIT_WRITE_BARRIER
+#error "USE_WRITE_VECTOR_SUMMARY needs USE_BIT_WRITE_BARRIER"
+#endif
+// Bit i of word w is set when RTwrite_vector[(w * BITS_PER_LONG) + i]
+// may have bits set. It grows with the write vector.
+extern LPTR write_vector_summary;
+#define WRITE_SUMMARY_INDEX(vector_index) ((vector_index) / BITS_PER_LONG)
+#define WRITE_SUMMARY_LENGTH(vector_length) \
+  (((vector_length) + BITS_PER_LONG - 1) / BITS_PER_LONG)
+#endif
 
 extern long *RTno_write_barrier_state_ptr;
 extern long saved_no_write_barrier_state;
 
+// Fresh regions in use per group, set by RTinit_heap
+extern int numa_node_count;
+
+// Threads marking, set by init_markers
+extern int marker_count;
+
+#if USE_SIMD_RANGE_SCAN
+#define RANGE_SCAN_SCALAR 0
+#define RANGE_SCAN_SSE2 1
+#define RANGE_SCAN_AVX2 2
+// The kernel conservative scans use, set by init_realtime_gc
+extern int range_scan_kernel;
+#endif
+
+// Heap object bytes the markers have scanned, and how long marking
+// took, over every cycle so far.
+extern long total_mark_bytes;
+extern struct timeval total_mark_tv;
+extern struct timeval max_mark_tv;
+
+#if USE_MARK_BITMAP
+// Two bitmaps indexed like the bit write vector, with their words
+// interleaved so a marker's check touches one cache line. Word
+// mark_word of each pair has the objects marked or allocated since the
+// last flip, the other word the ones that had been allocated by then.
+// The flip switches mark_word, and the sweep clears the allocated
+// words as it reads them, ready to be the next cycle's marks.
+extern LPTR mark_bits;
+extern int mark_word;
+#define MARK_BITS_BYTES_PER_PAGE \
+  (2 * (BYTES_PER_PAGE / (OBJECT_ALIGNMENT * BITS_PER_BYTE)))
+#define MARK_BIT_INDEX(ptr) (((BPTR) (ptr) - first_partition_ptr) / OBJECT_ALIGNMENT)
+#define MARK_BIT_PAIR(ptr) (mark_bits + (2 * (MARK_BIT_INDEX(ptr) / BITS_PER_LONG)))
+#define MARK_BIT_MASK(ptr) (1UL << (MARK_BIT_INDEX(ptr) % BITS_PER_LONG))
+// Allocators hold the free_lock, but markers set bits in the same words
+#define SET_MARK_BIT(ptr) \
+  locked_long_or(MARK_BIT_PAIR(ptr) + mark_word, MARK_BIT_MASK(ptr))
+
+// An object the markers still have to find
+static inline
+int unmarked_object(void *ptr) {
+  LPTR pair = MARK_BIT_PAIR(ptr);
+  unsigned long mask = MARK_BIT_MASK(ptr);
+  return((0 == (pair[mark_word] & mask)) && (0 != (pair[1 - mark_word] & mask)));
+}
+#define UNMARKEDP(ptr) unmarked_object(ptr)
+#else
+#define UNMARKEDP(ptr) WHITEP(ptr)
+#endif
+
+// The marker asks this about every candidate pointer, and doesn't take
+// the free_lock, so a region can move under it. A refill changes both
+// ends at once, so the pair is read again if the version says it was
+// moving. Carving only moves fresh up, and a stale fresh just makes a
+// newly carved object, which is black anyway, look uncarved. See
+// init_pages_for_group.
+static inline
+int carved_object(BPTR ptr, GPTR group) {
+  for (int i = 0; i < numa_node_count; i++) {
+    FRESH_REGION *region = &(group->regions[i]);
+    unsigned long version;
+    BPTR fresh, fresh_limit;
+    do {
+      version = region->version;
+      COMPILER_BARRIER();
+      fresh = region->fresh;
+      fresh_limit = region->fresh_limit;
+      COMPILER_BARRIER();
+    } while ((0 != (version & 1)) || (version != region->version));
+    if ((ptr >= fresh) && (ptr < fresh_limit)) {
+      return(0);
+    }
+  }
+  return(1);
+}
+
 #define LOCK(lock)  pthread_mutex_lock(&lock)
 #define UNLOCK(lock) pthread_mutex_unlock(&lock)
 #define WITH_LOCK(lock, code) LOCK(lock); \
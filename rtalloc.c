@@ -24,6 +24,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <limits.h>
 #include <unistd.h>
 #include <semaphore.h>
 #include <pthread.h>
@@ -34,79 +35,398 @@
 #include "mem-internals.h"
 #include "allocate.h"
 
+// O(1) size to group mapping, see the group macros in mem-internals.h.
+// Above 2 * MIN_GROUP_SIZE the top bit of size - 1 picks the power of
+// two and the next GROUP_SUBCLASS_BITS bits pick the class within it.
 static inline int size_to_group_index(int size) {
-  int s = size;
-  int index = 0;
-  
-  s = s - 1;
-  while (s != 0) {
-    s = s / 2;
-    index = index + 1;
+  long s = size - 1;
+  if (size <= (2 * MIN_GROUP_SIZE)) {
+    return(MAX(MIN_GROUP_INDEX, (s >> OBJECT_ALIGNMENT_POWER) - 1));
+  }
+  int power = (BITS_PER_LONG - 1) - __builtin_clzl(s);
+  int subclass = (s >> (power - GROUP_SUBCLASS_BITS)) & (GROUP_SUBCLASSES - 1);
+  return(FIRST_SUBCLASS_GROUP_INDEX +
+	 ((power - (MIN_GROUP_POWER + 1)) << GROUP_SUBCLASS_BITS) +
+	 subclass);
+}
+
+static
+int group_index_to_size(int index) {
+  if (index < FIRST_SUBCLASS_GROUP_INDEX) {
+    return((index + 2) * OBJECT_ALIGNMENT);
+  } else {
+    int n = index - FIRST_SUBCLASS_GROUP_INDEX;
+    int power = (MIN_GROUP_POWER + 1) + (n >> GROUP_SUBCLASS_BITS);
+    int subclass = n & (GROUP_SUBCLASSES - 1);
+    return((GROUP_SUBCLASSES + subclass + 1) <<
+	   (power - GROUP_SUBCLASS_BITS));
+  }
+}
+
+// Use the smallest run that holds at least one object and wastes no
+// more than an eighth of itself on the leftover tail.
+static
+void init_group_run(GPTR group) {
+  int size = group->size;
+  int run_pages = (size + BYTES_PER_PAGE - 1) / BYTES_PER_PAGE;
+  while (8 * ((run_pages * BYTES_PER_PAGE) % size) >
+	 (run_pages * BYTES_PER_PAGE)) {
+    run_pages = run_pages + 1;
+  }
+  group->run_pages = run_pages;
+  group->run_objects = (run_pages * BYTES_PER_PAGE) / size;
+  if (group->run_objects == 1) {
+    group->size_reciprocal = 0;
+  } else {
+    assert(run_pages <= (MAX_RUN_OFFSET + 1));
+    group->size_reciprocal = ((1L << SIZE_RECIPROCAL_SHIFT) / size) + 1;
   }
-  return(MAX(MIN_GROUP_INDEX, index));
 }
 
 static
 void init_group_info() {
-  for (int index = MIN_GROUP_INDEX; index <= MAX_GROUP_INDEX; index = index + 1) {
-    int size = 1 << index;
-    groups[index].size = size;
+  assert((LAST_GROUP_INDEX + FIRST_GROUP_ID) < GROUP_IDS);
+  for (int index = MIN_GROUP_INDEX; index <= LAST_GROUP_INDEX; index = index + 1) {
     groups[index].index = index;
+    page_group_table[GROUP_ID(&(groups[index]))] = &(groups[index]);
+    if (index <= MAX_GROUP_INDEX) {
+      int size = group_index_to_size(index);
+      assert(size_to_group_index(size) == index);
+      assert(size_to_group_index(size + 1) == index + 1);
+      groups[index].size = size;
+      init_group_run(&(groups[index]));
+    } else {
+      // The large object space, objects are at least this big
+      groups[index].size = LARGE_OBJECT_MIN_SIZE;
+      groups[index].run_pages = 0;
+      groups[index].run_objects = 0;
+      groups[index].size_reciprocal = 0;
+    }
     groups[index].free = NULL;
     groups[index].last = NULL;
     groups[index].white = NULL;
     groups[index].black = NULL;
     groups[index].gray = NULL;
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+      groups[index].regions[node].fresh = NULL;
+      groups[index].regions[node].fresh_limit = NULL;
+      groups[index].regions[node].version = 0;
+      groups[index].node_free[node] = NULL;
+      groups[index].node_last[node] = NULL;
+    }
     groups[index].white_count = 0;
     groups[index].black_scanned_count = 0;
     groups[index].black_alloc_count = 0;
+    groups[index].refill_runs = 1;
+    groups[index].last_refill_gc = 0;
+    groups[index].refill_count = 0;
+    groups[index].refill_page_count = 0;
     pthread_mutex_init(&(groups[index].free_lock), NULL);
     pthread_mutex_init(&(groups[index].black_and_last_lock), NULL);
+#if USE_PARALLEL_MARKING
+    // Markers only hold it for a few link updates, spinning a little
+    // beats sleeping in the kernel.
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_ADAPTIVE_NP);
+    pthread_mutex_init(&(groups[index].gray_lock), &attr);
+    pthread_mutexattr_destroy(&attr);
+#endif
+  }
+}
+
+// The heap segment, page table and write vector are each reserved for
+// heap_reserve_pages up front and committed from the bottom up.
+static long heap_reserve_pages;
+// Size of the next static segment chained on
+static size_t static_segment_bytes;
+static int heap_segment;
+// Pages an allocator couldn't get, protected by the empty_pages_lock
+static long heap_grow_request = 0;
+static int high_occupancy_cycles = 0;
+
+// Commit the pieces of table covering entries [first, first + count)
+static
+int commit_table(void *table, long entry_size, long first, long count) {
+  BPTR low = ROUND_DOWN_TO_OS_PAGE((BPTR) table + (first * entry_size));
+  BPTR high = (BPTR) table + ((first + count) * entry_size);
+  return(RTcommit_memory(low, high - low));
+}
+
+int hole_bin(long page_count) {
+  int power = (BITS_PER_LONG - 1) - __builtin_clzl(page_count);
+  if (power < HOLE_BIN_SUBCLASS_BITS) {
+    return(page_count);
   }
+  long subclass = (page_count >> (power - HOLE_BIN_SUBCLASS_BITS)) &
+    (HOLE_BIN_SUBCLASSES - 1);
+  return(((power - 1) * HOLE_BIN_SUBCLASSES) + subclass);
 }
 
-static 
-void init_page_info() {
-  for (int i = 0; i < total_partition_pages; i++) {
-    pages[i].base = NULL;
-    pages[i].group = SYSTEM_PAGE;
+// The first non-empty bin at or above bin, or -1 if there isn't one.
+int first_hole_bin(int bin) {
+  if (bin >= HOLE_BINS) {
+    return(-1);
   }
+  int word = bin / BITS_PER_LONG;
+  unsigned long bits = empty_bin_bits[word] & (~0UL << (bin % BITS_PER_LONG));
+  while (0 == bits) {
+    word = word + 1;
+    if (word == HOLE_BIN_WORDS) {
+      return(-1);
+    }
+    bits = empty_bin_bits[word];
+  }
+  return((word * BITS_PER_LONG) + __builtin_ctzl(bits));
 }
 
-void RTinit_empty_pages(int first_page, int page_count, int type) {
+// Caller must hold the empty_pages_lock for link_hole and unlink_hole
+static
+void link_hole(HOLE_PTR hole) {
+  int bin = hole_bin(hole->page_count);
+  long first_page = PTR_TO_PAGE_INDEX(hole);
+  hole->prev = NULL;
+  hole->next = empty_pages[bin];
+  if (NULL != hole->next) {
+    hole->next->prev = hole;
+  }
+  empty_pages[bin] = hole;
+  empty_bin_bits[bin / BITS_PER_LONG] |= (1UL << (bin % BITS_PER_LONG));
+  if ((hole->unreleased_first != hole->unreleased_end) &&
+      (hole->page_count >= RTrelease_min_pages)) {
+    empty_bin_oldest[bin] = MIN(empty_bin_oldest[bin], hole->empty_since);
+  }
+  empty_page_count = empty_page_count + hole->page_count;
+  page_bases[first_page] = (GCPTR) hole;
+  page_bases[first_page + hole->page_count - 1] = (GCPTR) hole;
+}
+
+static
+void unlink_hole(HOLE_PTR hole) {
+  int bin = hole_bin(hole->page_count);
+  if (NULL == hole->prev) {
+    empty_pages[bin] = hole->next;
+    if (NULL == hole->next) {
+      empty_bin_bits[bin / BITS_PER_LONG] &= ~(1UL << (bin % BITS_PER_LONG));
+      empty_bin_oldest[bin] = LONG_MAX;
+    }
+  } else {
+    hole->prev->next = hole->next;
+  }
+  if (NULL != hole->next) {
+    hole->next->prev = hole->prev;
+  }
+  empty_page_count = empty_page_count - hole->page_count;
+}
+
+// Widens the hole's unreleased span to cover pages first .. end
+static
+void add_unreleased_pages(HOLE_PTR hole, long first, long end) {
+  if (hole->unreleased_first == hole->unreleased_end) {
+    hole->unreleased_first = first;
+    hole->unreleased_end = end;
+  } else {
+    hole->unreleased_first = MIN(hole->unreleased_first, first);
+    hole->unreleased_end = MAX(hole->unreleased_end, end);
+  }
+}
+
+// Appends the hole right after it to hole. Only unreleased pages
+// need releasing again, which takes in the second hole's header page.
+static
+void merge_holes(HOLE_PTR hole, HOLE_PTR after) {
+  long offset = hole->page_count;
+  add_unreleased_pages(hole, offset, offset + 1);
+  if (after->unreleased_first != after->unreleased_end) {
+    add_unreleased_pages(hole, offset + after->unreleased_first,
+			 offset + after->unreleased_end);
+  }
+  hole->page_count = hole->page_count + after->page_count;
+  hole->empty_since = MAX(hole->empty_since, after->empty_since);
+}
+
+// Caller must hold the empty_pages_lock. The hole merges with the holes
+// on either side of it, if any, so holes never need a separate merging
+// pass. Pages only turn EMPTY under the lock, so a neighbor that looks
+// EMPTY always has its boundary tags set.
+static
+void link_merged_hole(HOLE_PTR hole) {
+  long first_page = PTR_TO_PAGE_INDEX(hole);
+  long last_page = first_page + hole->page_count;
+  if ((first_page > 0) &&
+      (PAGE_INDEX_TO_GROUP(first_page - 1) == EMPTY_PAGE)) {
+    HOLE_PTR before = (HOLE_PTR) page_bases[first_page - 1];
+    unlink_hole(before);
+    merge_holes(before, hole);
+    hole = before;
+  }
+  if ((last_page < total_partition_pages) &&
+      (PAGE_INDEX_TO_GROUP(last_page) == EMPTY_PAGE)) {
+    HOLE_PTR after = (HOLE_PTR) page_bases[last_page];
+    unlink_hole(after);
+    merge_holes(hole, after);
+  }
+  link_hole(hole);
+}
+
+// Caller must hold the empty_pages_lock
+void add_empty_pages(int first_page, int page_count) {
   int last_page = first_page + page_count;
   for (int i = first_page; i < last_page; i++) {
-    pages[i].base = NULL;
-    pages[i].group = EMPTY_PAGE;
+    pages[i].run_offset = 0;
+    SET_PAGE_GROUP(i, EMPTY_PAGE);
   }
+  HOLE_PTR new_hole = (HOLE_PTR) PAGE_INDEX_TO_PTR(first_page);
+  new_hole->page_count = page_count;
+  new_hole->empty_since = gc_count;
+  new_hole->unreleased_first = 0;
+  new_hole->unreleased_end = page_count;
+  link_merged_hole(new_hole);
+}
+
+// The biggest hole taken out of the pool, 0 once they're all back
+static long taken_hole_pages = 0;
+static int taken_hole_count = 0;
+static pthread_cond_t holes_returned = PTHREAD_COND_INITIALIZER;
 
+// Caller must hold the empty_pages_lock for take_hole and return_hole.
+// A taken hole can't be allocated, and its boundary pages look like
+// FREE_PAGEs so holes freed next to it don't merge with it, but its
+// pages still count as empty. release_idle_holes madvises taken holes
+// without the lock.
+void take_hole(HOLE_PTR hole) {
+  long first_page = PTR_TO_PAGE_INDEX(hole);
+  unlink_hole(hole);
+  empty_page_count = empty_page_count + hole->page_count;
+  SET_PAGE_GROUP(first_page, FREE_PAGE);
+  SET_PAGE_GROUP(first_page + hole->page_count - 1, FREE_PAGE);
+  taken_hole_pages = MAX(taken_hole_pages, hole->page_count);
+  taken_hole_count = taken_hole_count + 1;
+}
+
+void return_hole(HOLE_PTR hole) {
+  long first_page = PTR_TO_PAGE_INDEX(hole);
+  empty_page_count = empty_page_count - hole->page_count;
+  SET_PAGE_GROUP(first_page, EMPTY_PAGE);
+  SET_PAGE_GROUP(first_page + hole->page_count - 1, EMPTY_PAGE);
+  link_merged_hole(hole);
+  taken_hole_count = taken_hole_count - 1;
+  if (0 == taken_hole_count) {
+    taken_hole_pages = 0;
+    pthread_cond_broadcast(&holes_returned);
+  }
+}
+
+// The coalescer thread and the gc both add freed pages
+void RTinit_empty_pages(int first_page, int page_count, int type) {
   if (type == HEAP_SEGMENT) {
     pthread_mutex_lock(&empty_pages_lock);
-    // Add the pages to the front of the empty page list
-    HOLE_PTR new_hole = (HOLE_PTR) PAGE_INDEX_TO_PTR(first_page);
-    new_hole->page_count = page_count;
-    new_hole->next = empty_pages;
-    empty_pages = new_hole;
+    add_empty_pages(first_page, page_count);
     pthread_mutex_unlock(&empty_pages_lock);
   } else {
     Debugger("Can only init heap pages");
   }
 }
 
+#if USE_WRITE_VECTOR_SUMMARY
+// Summary words cover BITS_PER_LONG write vector words, which can be
+// less than a page's worth, so commit whole words spanning the pages.
+static
+int commit_write_summary(long first_page, long page_count) {
+  long words_per_page = WRITE_VECTOR_BYTES_PER_PAGE / sizeof(RTwrite_vector[0]);
+  long first = WRITE_SUMMARY_INDEX(first_page * words_per_page);
+  long end = WRITE_SUMMARY_LENGTH((first_page + page_count) * words_per_page);
+  return(commit_table(write_vector_summary, sizeof(long), first, end - first));
+}
+#endif
+
+// Only the gc thread grows the heap, once it's done walking the page
+// table for the cycle. The tables cover the new pages before
+// last_partition_ptr moves, so IN_PARTITION never admits a pointer
+// they can't handle.
+static
+long grow_heap(long page_count) {
+  long first_page = total_partition_pages;
+  if (0 != RTuse_huge_pages) {
+    page_count = ROUND_UP_TO_HUGE_PAGE(page_count * BYTES_PER_PAGE) /
+      BYTES_PER_PAGE;
+  }
+  page_count = MIN(page_count, heap_reserve_pages - first_page);
+  if ((page_count <= 0) ||
+      !commit_table(pages, sizeof(PAGE_INFO), first_page, page_count) ||
+      !commit_table(page_bases, sizeof(GCPTR), first_page, page_count) ||
+      !commit_table(run_live_counts, sizeof(int), first_page, page_count) ||
+      !commit_table(dead_runs, sizeof(int), first_page, page_count) ||
+      !commit_table(RTwrite_vector, WRITE_VECTOR_BYTES_PER_PAGE,
+		    first_page, page_count) ||
+#if USE_MARK_BITMAP
+      !commit_table(mark_bits, MARK_BITS_BYTES_PER_PAGE,
+		    first_page, page_count) ||
+#endif
+#if USE_WRITE_VECTOR_SUMMARY
+      !commit_write_summary(first_page, page_count) ||
+#endif
+      !RTcommit_heap_memory(PAGE_INDEX_TO_PTR(first_page),
+			    page_count * BYTES_PER_PAGE)) {
+    return(0);
+  }
+  // The new pages are already a hole when they're counted, and nobody
+  // can take them until last_partition_ptr covers them.
+  pthread_mutex_lock(&empty_pages_lock);
+  add_empty_pages(first_page, page_count);
+  RTwrite_vector_length = RTwrite_vector_length +
+    ((page_count * WRITE_VECTOR_BYTES_PER_PAGE) / sizeof(RTwrite_vector[0]));
+  total_partition_pages = total_partition_pages + page_count;
+  last_partition_ptr = PAGE_INDEX_TO_PTR(total_partition_pages);
+  segments[heap_segment].last_segment_ptr = last_partition_ptr;
+  segments[heap_segment].segment_page_count = total_partition_pages;
+  pthread_mutex_unlock(&empty_pages_lock);
+  return(page_count);
+}
+
+// Called by the gc after coalescing. Pages freed by this cycle's
+// recycling count as free even while they sit on free lists.
+void maybe_grow_heap(long recycled_bytes) {
+  pthread_mutex_lock(&empty_pages_lock);
+  long requested = heap_grow_request;
+  heap_grow_request = 0;
+  long hole_pages = empty_page_count;
+  pthread_mutex_unlock(&empty_pages_lock);
+
+  long free_pages = hole_pages + (recycled_bytes / BYTES_PER_PAGE);
+  long used_pages = total_partition_pages - free_pages;
+  if ((100 * used_pages) >
+      (HEAP_GROW_OCCUPANCY_PERCENT * total_partition_pages)) {
+    high_occupancy_cycles = high_occupancy_cycles + 1;
+  } else {
+    high_occupancy_cycles = 0;
+  }
+  if ((requested > 0) || (high_occupancy_cycles >= HEAP_GROW_CYCLES)) {
+    long grow_pages = MAX(requested,
+			  (total_partition_pages * HEAP_GROW_PERCENT) / 100);
+    grow_heap(grow_pages);
+    high_occupancy_cycles = 0;
+  }
+}
+
 static
 long allocate_segment(size_t desired_bytes, int type) {
   size_t actual_bytes = 0;
   BPTR first_segment_ptr, last_segment_ptr;
-  int segment_page_count, first_segment_page;
+  int segment_page_count;
   int segment = total_segments;
 
   if ((desired_bytes > 0) &&
       (desired_bytes == (desired_bytes & ~PAGE_ALIGNMENT_MASK)) &&
       (total_segments < MAX_SEGMENTS)) {
-    first_segment_ptr = RTbig_malloc(desired_bytes);
+    if (type == HEAP_SEGMENT) {
+      first_segment_ptr = RTreserve_memory(heap_reserve_pages *
+					   BYTES_PER_PAGE);
+    } else {
+      first_segment_ptr = RTbig_malloc(desired_bytes);
+    }
 
     if (NULL != first_segment_ptr) {
-      total_segments = total_segments + 1;
       actual_bytes = desired_bytes;
       segment_page_count = actual_bytes / BYTES_PER_PAGE;
       segments[segment].first_segment_ptr = first_segment_ptr;
@@ -115,20 +435,24 @@ long allocate_segment(size_t desired_bytes, int type) {
       segments[segment].last_segment_ptr = last_segment_ptr;
       segments[segment].segment_page_count = segment_page_count;
       segments[segment].type = type;
+      segments[segment].frontier_ptr = first_segment_ptr;
+      segments[segment].flip_frontier_ptr = first_segment_ptr;
+      // The static space scanner can look at the segment from now on
+      total_segments = total_segments + 1;
 
-      // for now we only support a single static segment and
-      // a single heap segment
+      // for now we only support a single heap segment
       switch (type) {
       case HEAP_SEGMENT:
+	// Starts out empty, grow_heap commits the first desired_bytes
+	heap_segment = segment;
 	first_partition_ptr = first_segment_ptr;
-	last_partition_ptr = last_segment_ptr;
-	first_segment_page = PTR_TO_PAGE_INDEX(first_segment_ptr);
-	RTinit_empty_pages(first_segment_page, segment_page_count, type);
+	last_partition_ptr = first_segment_ptr;
+	if (grow_heap(segment_page_count) < segment_page_count) {
+	  actual_bytes = 0;
+	}
 	break;
       case STATIC_SEGMENT:
-	last_static_ptr = segments[0].last_segment_ptr;
-	first_static_ptr = segments[0].first_segment_ptr;
-	static_frontier_ptr = first_static_ptr;
+	current_static_segment = segment;
 	break;
       default: break;
       }
@@ -139,147 +463,353 @@ long allocate_segment(size_t desired_bytes, int type) {
   return(actual_bytes);
 }
 
+// Takes the first hole from the smallest bin whose holes are all big
+// enough, and only falls back to searching page_count's own bin when
+// there's nothing bigger.
 static
 GCPTR allocate_empty_pages(int page_count) {
-  int remaining_page_count, best_remaining_page_count;
   GCPTR base = NULL;
-  HOLE_PTR prev = NULL;
   HOLE_PTR best = NULL;
-  HOLE_PTR best_prev = NULL;
+  int bin = hole_bin(page_count);
+  int fit_bin = ((page_count > 1) && (hole_bin(page_count - 1) == bin)) ?
+    bin + 1 : bin;
 
   pthread_mutex_lock(&empty_pages_lock);
-  HOLE_PTR next = empty_pages;
-  // Search for a best fit hole
-  best_remaining_page_count = total_partition_pages + 1;
-  while ((best_remaining_page_count > 0) && (next != NULL)) {
-    if (next->page_count >= page_count) {
-      remaining_page_count = next->page_count - page_count;
-      if (remaining_page_count < best_remaining_page_count) {
-	best_remaining_page_count = remaining_page_count;
+  int found_bin = first_hole_bin(fit_bin);
+  if (found_bin >= 0) {
+    best = empty_pages[found_bin];
+  } else {
+    for (HOLE_PTR next = empty_pages[bin]; next != NULL; next = next->next) {
+      if (next->page_count >= page_count) {
 	best = next;
-	best_prev = prev;
+	break;
       }
     }
-    prev = next;
-    next = next->next;
   }
 
   if (best != NULL) {
-    HOLE_PTR rest;
-    if (best_remaining_page_count == 0) {
-      rest = best->next;
-    } else {
-      rest = (HOLE_PTR) ((BPTR) best + (page_count * BYTES_PER_PAGE));
-      rest->page_count = best_remaining_page_count;
-      rest->next = best->next;
-    }
-    if (best_prev == NULL) {
-      empty_pages = rest;
-    } else {
-      best_prev->next = rest;
+    unlink_hole(best);
+    if (best->page_count > page_count) {
+      HOLE_PTR rest = (HOLE_PTR) ((BPTR) best + (page_count * BYTES_PER_PAGE));
+      long unreleased_end = (best->unreleased_first == best->unreleased_end) ?
+	0 : best->unreleased_end - page_count;
+      rest->page_count = best->page_count - page_count;
+      rest->empty_since = best->empty_since;
+      // Whatever of the span is left, and the rest's new header page
+      rest->unreleased_first = 0;
+      rest->unreleased_end = MIN(rest->page_count, MAX(1, unreleased_end));
+      link_hole(rest);
     }
     base = (GCPTR) best;
+    // Until the caller sets up its page table entries, keep the gc from
+    // taking these pages' boundary tags for a neighboring hole's.
+    long first_page = PTR_TO_PAGE_INDEX(base);
+    SET_PAGE_GROUP(first_page, SYSTEM_PAGE);
+    SET_PAGE_GROUP(first_page + page_count - 1, SYSTEM_PAGE);
   }
   pthread_mutex_unlock(&empty_pages_lock);
   return(base);
 }
 
+// Whoever calls this function has to be holding the group->free_lock,
+// which is dropped while we wait for the gc to free up some pages.
+// Returns 1 if it only waited for holes being released to come back,
+// which is much sooner, so there may still be nothing that fits.
+static
+int wait_for_empty_pages(GPTR group, int page_count) {
+  pthread_mutex_lock(&empty_pages_lock);
+  if (page_count <= taken_hole_pages) {
+    pthread_mutex_unlock(&(group->free_lock));
+    while (page_count <= taken_hole_pages) {
+      pthread_cond_wait(&holes_returned, &empty_pages_lock);
+    }
+    pthread_mutex_unlock(&empty_pages_lock);
+    pthread_mutex_lock(&(group->free_lock));
+    return(1);
+  }
+  // If collecting doesn't free up enough pages, the gc commits more of
+  // the heap reservation at the end of the cycle.
+  heap_grow_request = MAX(heap_grow_request, page_count);
+  pthread_mutex_unlock(&empty_pages_lock);
+  // atomic and concurrent gc can't flip without
+  // unlocking all group free locks
+  pthread_mutex_unlock(&(group->free_lock));
+  long current_gc_count = gc_count;
+  if (RTatomic_gc) {
+    // atomic gc
+    run_gc = 1;
+    while (gc_count < (current_gc_count + 2)) {
+      sched_yield();
+    }
+  } else {
+    // concurrent gc
+    // need to wait until gc count increases by 2
+    printf("alloc out ran gc, sync collect\n");
+    while (gc_count < (current_gc_count + 2)) {
+      // Should use a condition variable counter instead of polling here
+      sched_yield();
+    }
+  }
+  pthread_mutex_lock(&(group->free_lock));
+  return(0);
+}
+
 // Whoever calls this function has to be holding the group->free_lock.
+// The new pages become the node's fresh region. Nothing on them is
+// touched here, allocate_object carves objects off the region one at a
+// time as they are handed out. Pages come in whole runs.
 static
-void init_pages_for_group(GPTR group, int min_pages) {
-  int pages_per_object = group->size / BYTES_PER_PAGE;
-  int byte_count = MAX(pages_per_object,min_pages) * BYTES_PER_PAGE;
-  int num_objects = byte_count >> group->index;
-  int page_count = (num_objects * group->size) / BYTES_PER_PAGE;
+void init_pages_for_group(GPTR group, int node, int min_pages) {
+  FRESH_REGION *region = &(group->regions[node]);
+  int run_count = (min_pages + group->run_pages - 1) / group->run_pages;
+  int page_count = MAX(1, run_count) * group->run_pages;
+  int byte_count = page_count * BYTES_PER_PAGE;
   GCPTR base = allocate_empty_pages(page_count);
 
-  if (base == NULL) {
-    int actual_bytes = allocate_segment(MAX(DEFAULT_HEAP_SEGMENT_SIZE,
-					    page_count * BYTES_PER_PAGE),
-					HEAP_SEGMENT);
-    assert(0 == actual_bytes);	// while we only have 1 segment
-    if (actual_bytes < byte_count) {
-      // atomic and concurrent gc can't flip without
-      // unlocking all group free locks
-      pthread_mutex_unlock(&(group->free_lock));
-      long current_gc_count = gc_count;
-      if (RTatomic_gc) {
-	// atomic gc
-	run_gc = 1;
-	while (gc_count < (current_gc_count + 2)) {
-	  sched_yield();
-	}
-      } else {
-	// concurrent gc
-	// need to wait until gc count increases by 2
-	printf("alloc out ran gc, sync collect\n");
-	while (gc_count < (current_gc_count + 2)) {
-	  // Should use a condition variable counter instead of polling here
-	  sched_yield();
-	}
-      }
-      pthread_mutex_lock(&(group->free_lock));
-    }
-    if (NULL == group->free) {
+  if ((base == NULL) && (page_count > group->run_pages)) {
+    // Don't make a big refill wait when a single run would do
+    group->refill_runs = 1;
+    page_count = group->run_pages;
+    byte_count = page_count * BYTES_PER_PAGE;
+    base = allocate_empty_pages(page_count);
+  }
+  int released = 1;
+  while ((base == NULL) && released) {
+    released = wait_for_empty_pages(group, page_count);
+    if ((NULL == group->free) && REGION_EMPTY(region)) {
       base = allocate_empty_pages(page_count);
     } else {
-      // Gc added to free list, so no need to allocate or init empty pages.
-      // Could just continue because base is still NULL, but being explicit
-      // here seems clearer.
+      // Gc added to free list, or another thread refilled the group while
+      // the free_lock was dropped, so no need to allocate or init empty
+      // pages. Allocating here would abandon the other thread's fresh
+      // region, whose uncarved objects can carry stale headers.
       return;
     }
   }
 
   if (base != NULL) {
-    GCPTR current = NULL;
-    GCPTR next = base;
-    for (int i = 0; i < num_objects; i++) {
-      GCPTR prev = current;
-      current = next;
-      next = (GCPTR) ((BPTR) current + group->size);
-      current->prev = prev;
-      current->next = next;
-      SET_COLOR(current,GREEN);
-    }
-    SET_LINK_POINTER(current->next,NULL);
-    assert(NULL == group->free);
-    WITH_LOCK((group->black_and_last_lock),
-	      GCPTR last = group->last;
-	      group->free = base;
-	      if (last == NULL) { 	// No gray, black, or green objects?
-		group->black = base;
-	      } else {
-		SET_LINK_POINTER(base->prev, last);
-		SET_LINK_POINTER(last->next,base);
-	      }
-	      group->last = current;);
+    assert(REGION_EMPTY(region));
+    group->refill_count = group->refill_count + 1;
+    group->refill_page_count = group->refill_page_count + page_count;
+    if (numa_node_count > 1) {
+      RTbind_to_numa_node(base, byte_count, node);
+    }
+    // Scanners read the region without the free_lock. Seeing one end
+    // moved and not the other could make live objects between the old
+    // fresh and the new limit look uncarved, so the version is odd
+    // while both ends move and carved_object reads them again.
+    int run_bytes = group->run_pages * BYTES_PER_PAGE;
+    region->version = region->version + 1;
+    COMPILER_BARRIER();
+    region->fresh_limit = (BPTR) base + (byte_count - run_bytes) +
+      (group->run_objects * group->size);
+    region->fresh = (BPTR) base;
+    COMPILER_BARRIER();
+    region->version = region->version + 1;
     // Only now can we initialize EMPTY page table entries.
-    // Doing it before object GCHDRs are correctly setup and colored green
-    // allows conservative pointers and exposed uncleared
-    // dead pointers on the stack to incorrectly make_gray 
-    // random bits that look like white objects!
-    if (base != NULL) {
-      int i;
-      int next_page_index = PTR_TO_PAGE_INDEX(((BPTR) base));
-      for (i = 1; i <= page_count; i++) {
-	pages[next_page_index].base = base;
-	pages[next_page_index].group = group;
-	next_page_index = next_page_index + 1;
+    // Conservative pointers and exposed uncleared dead pointers on the
+    // stack can point anywhere in these pages. The scanners ignore
+    // anything in the fresh region, so they must see the region before
+    // they can find the pages.
+    int next_page_index = PTR_TO_PAGE_INDEX(((BPTR) base));
+    for (int i = 0; i < page_count; i++) {
+      BPTR run_base = (BPTR) base + ((i / group->run_pages) * run_bytes);
+      if (group->size_reciprocal == 0) {
+	page_bases[next_page_index] = (GCPTR) run_base;
+	pages[next_page_index].run_offset = 0;
+      } else {
+	pages[next_page_index].run_offset = i % group->run_pages;
       }
+      if (0 == (i % group->run_pages)) {
+	run_live_counts[next_page_index] = 0;
+      }
+      pages[next_page_index].node = node;
+      SET_PAGE_GROUP(next_page_index, group);
+      next_page_index = next_page_index + 1;
     }
   }
 }
 
+// Caller must hold the group->free_lock. Sets up a new black header
+// and links it onto the end of the group's treadmill.
+static inline
+void link_new_black_object(GPTR group, GCPTR new) {
+  new->prev = NULL;
+  new->next = NULL;
+  SET_COLOR(new,marked_color);	// Must allocate black!
+#if USE_MARK_BITMAP
+  SET_MARK_BIT(new);
+#endif
+  WITH_LOCK((group->black_and_last_lock),
+	    GCPTR last = group->last;
+	    if (last == NULL) {	// No gray, black, or green objects?
+	      group->black = new;
+	    } else {
+	      SET_LINK_POINTER(new->prev, last);
+	      SET_LINK_POINTER(last->next, new);
+	    }
+	    group->last = new;);
+}
+
+// Caller must hold the group->free_lock. The header is fully set up
+// and linked after last before fresh moves past the object, because
+// the gc treats everything at or above fresh as garbage bits.
+static inline
+GCPTR carve_fresh_object(GPTR group, FRESH_REGION *region) {
+  GCPTR new = (GCPTR) region->fresh;
+  link_new_black_object(group, new);
+  // Skip the leftover tail at the end of each run
+  BPTR next = region->fresh + group->size;
+  BPTR run_end = (BPTR) PAGE_INDEX_TO_RUN_BASE(PTR_TO_PAGE_INDEX(new), group) +
+    (group->run_pages * BYTES_PER_PAGE);
+  if ((next != region->fresh_limit) && ((next + group->size) > run_end)) {
+    next = run_end;
+  }
+  region->fresh = next;
+  long run_page = PTR_TO_RUN_PAGE_INDEX(new);
+  run_live_counts[run_page] = run_live_counts[run_page] + 1;
+  return(new);
+}
+
+// Caller must hold the group->free_lock. How many pages the group's
+// next refill should ask for, based on how recently it last needed one.
+static inline
+int refill_page_count(GPTR group) {
+#if USE_ADAPTIVE_REFILL
+  long cycles = gc_count - group->last_refill_gc;
+  if (cycles == 0) {
+    int max_runs = REFILL_MAX_BYTES / (group->run_pages * BYTES_PER_PAGE);
+    group->refill_runs = MAX(1, MIN(2 * group->refill_runs, max_runs));
+  } else if (cycles > 1) {
+    group->refill_runs = MAX(1, group->refill_runs / 2);
+  }
+  group->last_refill_gc = gc_count;
+#endif
+  return(group->refill_runs * group->run_pages);
+}
+
+// Caller must hold the group->free_lock. Any other node's region that
+// still has objects, or NULL.
+static
+FRESH_REGION *other_fresh_region(GPTR group) {
+  for (int node = 0; node < numa_node_count; node++) {
+    if (!REGION_EMPTY(&(group->regions[node]))) {
+      return(&(group->regions[node]));
+    }
+  }
+  return(NULL);
+}
+
+// Caller must hold the group->free_lock. Takes the first free object on
+// this thread's node if there is one, otherwise the group's first. One
+// from further down the free list is moved in front of free, where
+// allocated objects go, but only once there's a black object there.
+// Until then the marker can be linking gray objects in front of
+// group->black, which is free, without the free_lock.
+static
+GCPTR take_free_object(GPTR group) {
+  GCPTR free = group->free;
+  GCPTR new = group->node_free[RTcurrent_numa_node()];
+  if ((new == NULL) || (group->black == free) ||
+      (NULL == GET_LINK_POINTER(free->prev))) {
+    new = free;
+  }
+  int node = pages[PTR_TO_PAGE_INDEX(new)].node;
+  GCPTR prev = GET_LINK_POINTER(new->prev);
+  GCPTR next = GET_LINK_POINTER(new->next);
+  if (new == group->node_free[node]) {
+    if (new == group->node_last[node]) {
+      group->node_free[node] = NULL;
+      group->node_last[node] = NULL;
+    } else {
+      group->node_free[node] = next;
+    }
+  } else if (new == group->node_last[node]) {
+    group->node_last[node] = prev;
+  }
+  if (new == free) {
+    group->free = next;
+  } else {
+    SET_LINK_POINTER(prev->next, next);
+    if (next == NULL) {
+      group->last = prev;
+    } else {
+      SET_LINK_POINTER(next->prev, prev);
+    }
+    GCPTR black_last = GET_LINK_POINTER(free->prev);
+    SET_LINK_POINTER(new->prev, black_last);
+    SET_LINK_POINTER(new->next, free);
+    SET_LINK_POINTER(black_last->next, new);
+    SET_LINK_POINTER(free->prev, new);
+  }
+  return(new);
+}
+
+// Caller must hold the group->free_lock. Recycled green objects are
+// used first, preferring ones on this thread's node, then the fresh
+// region for this thread's node, then new pages. Returns a black
+// object, or NULL if the heap is exhausted.
+static inline
+GCPTR allocate_object(GPTR group) {
+  GCPTR new = group->free;
+  if (new == NULL) {
+    int node = RTcurrent_numa_node();
+    FRESH_REGION *region = &(group->regions[node]);
+    if (REGION_EMPTY(region)) {
+      init_pages_for_group(group, node, refill_page_count(group));
+      // The gc may have recycled objects while we waited for it
+      new = group->free;
+    }
+    if (new == NULL) {
+      if (REGION_EMPTY(region)) {
+	// Out of pages, so take objects from another node's region
+	region = other_fresh_region(group);
+	if (region == NULL) {
+	  return(NULL);
+	}
+      }
+      new = carve_fresh_object(group, region);
+      DEBUG(group->black_alloc_count = group->black_alloc_count + 1);
+      return(new);
+    }
+  }
+  if (numa_node_count > 1) {
+    new = take_free_object(group);
+  } else {
+    group->free = GET_LINK_POINTER(new->next);
+  }
+  long run_page = PTR_TO_RUN_PAGE_INDEX(new);
+  run_live_counts[run_page] = run_live_counts[run_page] + 1;
+  // No need for an explicit flip lock here. During a flip the gc will
+  // hold the free_lock for every group, so no allocator can get here
+  // when the marked_color is being changed.
+  SET_COLOR(new,marked_color);	// Must allocate black!
+#if USE_MARK_BITMAP
+  SET_MARK_BIT(new);
+#endif
+  DEBUG(group->black_alloc_count = group->black_alloc_count + 1);
+  return(new);
+}
+
 static inline
 GPTR allocation_group(long *metadata, int size) {
   int data_size, real_size;
   if (size >= 0) {
     switch ((long) metadata) {
     case (long) RTnopointers:
+      real_size = size + sizeof(GC_HEADER); 
+      break;
     case (long) RTpointers:
     case (long) RTcustom1:
       // delete - dead variable: data_size = size;
       real_size = size + sizeof(GC_HEADER); 
+#if USE_EXACT_OBJECT_SIZE
+      // Leave room for the size word. Smaller objects that still land
+      // in an exact size group always have at least a word to spare.
+      if ((real_size + sizeof(long)) >= EXACT_SIZE_MIN_OBJECT_SIZE) {
+	real_size = real_size + sizeof(long);
+      }
+#endif
       break;
     default:
       data_size = (metadata[0] * size) + sizeof(void *);
@@ -288,6 +818,11 @@ GPTR allocation_group(long *metadata, int size) {
     }
     
     GPTR group;
+#if USE_LARGE_OBJECT_SPACE
+    if (real_size >= LARGE_OBJECT_MIN_SIZE) {
+      return(LARGE_GROUP);
+    }
+#endif
     int group_index = size_to_group_index(real_size);
     if (group_index > MAX_GROUP_INDEX) {
       printf("%d", real_size);
@@ -301,12 +836,40 @@ GPTR allocation_group(long *metadata, int size) {
   }
 }
 
+// How much of the body a new object uses, which is what has to be zeroed
 static inline
-int initialize_object_metadata(void *metadata, GCPTR gcptr, GPTR group) {
+int object_body_size(void *metadata, GPTR group, int size) {
   long md = (long) metadata;
   int body_size = group->size - sizeof(GC_HEADER);
+  if (md >= SC_METADATA) {
+    body_size = body_size - sizeof(LPTR);
+#if USE_EXACT_OBJECT_SIZE
+  } else if (EXACT_SIZE_GROUP(group) && EXACT_SIZE_CLASS(md)) {
+    body_size = ROUND_UPTO_LONG_ALIGNMENT(size);
+#endif
+  }
+  return(body_size);
+}
+
+static inline
+void set_object_size_word(void *metadata, GCPTR gcptr, GPTR group,
+			  int body_size) {
+#if USE_EXACT_OBJECT_SIZE
+  if (EXACT_SIZE_GROUP(group) && EXACT_SIZE_CLASS((long) metadata)) {
+    *OBJECT_SIZE_WORD(gcptr, group) = body_size;
+  }
+#endif
+}
+
+// Returns the number of body bytes the caller still has to zero.
+static inline
+int initialize_object_metadata(void *metadata, GCPTR gcptr, GPTR group,
+			       int size) {
+  long md = (long) metadata;
+  int body_size = object_body_size(metadata, group, size);
   if (md < SC_METADATA) {
     SET_STORAGE_CLASS(gcptr, md);
+    set_object_size_word(metadata, gcptr, group, body_size);
   } else {
     LPTR base = (LPTR) (gcptr + 1);
     LPTR last_ptr = base + (group->size / sizeof(LPTR)) - 3;
@@ -315,8 +878,14 @@ int initialize_object_metadata(void *metadata, GCPTR gcptr, GPTR group) {
     // uninitialized md pointer.
     *last_ptr = md;
     SET_STORAGE_CLASS(gcptr, SC_METADATA);
-    body_size = body_size - sizeof(LPTR);
   }
+#if USE_GC_PREZEROING
+  if (ZEROEDP(gcptr)) {
+    // The gc already zeroed the body, there's nothing left to clear
+    CLEAR_ZEROED(gcptr);
+    body_size = 0;
+  }
+#endif
   return(body_size);
 }
 
@@ -327,24 +896,164 @@ LPTR initialize_object_body(void *metadata, LPTR base, int body_size) {
   }
 }
 
-void *RTallocate(void *metadata, int size) {
-  GPTR group = allocation_group(metadata,size);
+#if USE_THREAD_CACHES
+// Cached objects whose bodies the gc already zeroed are tagged in the
+// low bit. A tagged pointer is still an interior pointer to the object.
+#define PREZEROED_TAG 1
+
+// Grab up to THREAD_CACHE_SIZE objects under a single free_lock round
+// trip. They are allocated black and get their storage class and
+// metadata here, exactly like RTallocate does, so the gc never sees
+// a cached object in an inconsistent state.
+static
+int refill_thread_cache(THREAD_CACHE *cache, void *metadata, GPTR group,
+			int size) {
+  int count = 0;
   pthread_mutex_lock(&(group->free_lock));
-  if (group->free == NULL) {
-    init_pages_for_group(group,1);
-    if (group->free == NULL) {
-      out_of_memory("Heap", group->size);
+  cache->metadata = metadata;
+  while (count < THREAD_CACHE_SIZE) {
+    GCPTR new = allocate_object(group);
+    if (new == NULL) {
+      if (count == 0) {
+	out_of_memory("Heap", group->size);
+      }
+      break;
+    }
+    if (0 == initialize_object_metadata(metadata, new, group, size)) {
+      new = (GCPTR) ((long) new | PREZEROED_TAG);
     }
+    cache->objects[count] = new;
+    count = count + 1;
+    // Publish each object as we go. allocate_object can drop the
+    // free_lock to wait out whole gc cycles, and the flip handler only
+    // copies objects[0..count) from this thread, so none can be missed.
+    cache->count = count;
+  }
+  pthread_mutex_unlock(&(group->free_lock));
+  return(count);
+}
+
+// Returns NULL if the cache holds objects for different metadata, in
+// which case the caller falls back to the locked allocation path.
+static inline
+void *allocate_from_thread_cache(THREAD_INFO *thread,
+				 void *metadata,
+				 GPTR group,
+				 int size) {
+  THREAD_CACHE *cache = &(thread->caches[group->index]);
+  int count = cache->count;
+  if (count == 0) {
+    count = refill_thread_cache(cache, metadata, group, size);
+  } else if (cache->metadata != metadata) {
+    return(NULL);
+  }
+  // Read the object before dropping the count. If we flip in between,
+  // the handler still sees it in the cache, after that it's in a register.
+  GCPTR new = cache->objects[count - 1];
+  cache->count = count - 1;
+  int zeroed = (0 != ((long) new & PREZEROED_TAG));
+  new = (GCPTR) ((long) new & ~PREZEROED_TAG);
+  // The size word was set for the size that refilled the cache. If we
+  // flip before it's reset, the gc just scans a bit more or less of a
+  // black object the SATB snapshot doesn't depend on.
+  int body_size = object_body_size(metadata, group, size);
+  set_object_size_word(metadata, new, group, body_size);
+  LPTR base = (LPTR) (new + 1);
+  if (!zeroed) {
+    initialize_object_body(metadata, base, body_size);
+  }
+  return(base);
+}
+
+static
+void reset_thread_caches(THREAD_INFO *thread) {
+  for (int i = MIN_GROUP_INDEX; i <= MAX_GROUP_INDEX; i++) {
+    thread->caches[i].count = 0;
+    thread->caches[i].metadata = NULL;
+  }
+}
+#endif
+
+#if USE_LARGE_OBJECT_SPACE
+// Large objects get exactly the pages they need. Their size lives in
+// the prefix, so they need no size word and metadata goes in their
+// last word as usual.
+static
+void *allocate_large_object(void *metadata, int size) {
+  GPTR group = LARGE_GROUP;
+  long md = (long) metadata;
+  long body_size = size;
+  if (md >= SC_METADATA) {
+    body_size = (((RT_METADATA *) metadata)[0] * size) + sizeof(LPTR);
+  }
+  long object_size = (sizeof(GC_HEADER) + body_size + OBJECT_ALIGNMENT - 1) &
+    ~(OBJECT_ALIGNMENT - 1);
+  int page_count = LARGE_OBJECT_PAGES(object_size);
+
+  pthread_mutex_lock(&(group->free_lock));
+  BPTR base = (BPTR) allocate_empty_pages(page_count);
+  while (base == NULL) {
+    int released = wait_for_empty_pages(group, page_count);
+    base = (BPTR) allocate_empty_pages(page_count);
+    if ((base == NULL) && !released) {
+      out_of_memory("Large object", object_size);
+    }
+  }
+  GCPTR new = (GCPTR) (base + LARGE_OBJECT_PREFIX_SIZE);
+  LARGE_OBJECT_SIZE(new) = object_size;
+  link_new_black_object(group, new);
+  if (md < SC_METADATA) {
+    SET_STORAGE_CLASS(new, md);
+  } else {
+    LPTR last_ptr = (LPTR) ((BPTR) new + object_size) - 1;
+    *last_ptr = md;
+    SET_STORAGE_CLASS(new, SC_METADATA);
+    body_size = body_size - sizeof(LPTR);
   }
-  GCPTR new = group->free;
-  group->free = GET_LINK_POINTER(new->next);
-  // No need for an explicit flip lock here. During a flip the gc will
-  // hold the free_lock for every group, so no allocator can get here
-  // when the marked_color is being changed.
-  SET_COLOR(new,marked_color);	// Must allocate black!
   DEBUG(group->black_alloc_count = group->black_alloc_count + 1);
-    
-  int body_size = initialize_object_metadata(metadata, new, group);
+  // Like init_pages_for_group, make the pages visible to conservative
+  // scanning only once the header is valid.
+  // The pages aren't bound, they're first touched on this node
+  int node = RTcurrent_numa_node();
+  int next_page_index = PTR_TO_PAGE_INDEX(base);
+  for (int i = 0; i < page_count; i++) {
+    page_bases[next_page_index] = new;
+    pages[next_page_index].run_offset = 0;
+    pages[next_page_index].node = node;
+    SET_PAGE_GROUP(next_page_index, group);
+    next_page_index = next_page_index + 1;
+  }
+  pthread_mutex_unlock(&(group->free_lock));
+  LPTR body = (LPTR) (new + 1);
+  initialize_object_body(metadata, body, body_size);
+  return(body);
+}
+#endif
+
+void *RTallocate(void *metadata, int size) {
+  GPTR group = allocation_group(metadata,size);
+#if USE_LARGE_OBJECT_SPACE
+  if (group == LARGE_GROUP) {
+    return(allocate_large_object(metadata, size));
+  }
+#endif
+#if USE_THREAD_CACHES
+  if (group->size <= THREAD_CACHE_MAX_OBJECT_SIZE) {
+    THREAD_INFO *thread = pthread_getspecific(thread_key);
+    if (thread != NULL) {
+      void *base = allocate_from_thread_cache(thread, metadata, group, size);
+      if (base != NULL) {
+	return(base);
+      }
+    }
+  }
+#endif
+  pthread_mutex_lock(&(group->free_lock));
+  GCPTR new = allocate_object(group);
+  if (new == NULL) {
+    out_of_memory("Heap", group->size);
+  }
+  int body_size = initialize_object_metadata(metadata, new, group, size);
   // Unlock only after storage class and md initialization because
   // gc recyling garbage can read and write next ptr and md.
   pthread_mutex_unlock(&(group->free_lock));
@@ -353,29 +1062,106 @@ void *RTallocate(void *metadata, int size) {
   return(base);
 }
 
-void *RTstatic_allocate(void *metadata, int size) {
-  size = ROUND_UPTO_LONG_ALIGNMENT(size);
-  
-  // Should we lock during flip and copy frontier_ptr at that time?
-  // Seems like it shouldn't be needed.
+// Allocate count objects of the same type, taking the free_lock once
+// per ALLOCATE_MANY_CHUNK_SIZE of them so a big batch can't hold off a
+// flip. Like the pointer RTallocate returns, out must be somewhere the
+// gc scans, i.e. on the stack or in a heap object.
+void RTallocate_many(void *metadata, int size, int count, void **out) {
+  GPTR group = allocation_group(metadata,size);
+#if USE_LARGE_OBJECT_SPACE
+  if (group == LARGE_GROUP) {
+    for (int i = 0; i < count; i++) {
+      out[i] = allocate_large_object(metadata, size);
+    }
+    return;
+  }
+#endif
+  int body_size = object_body_size(metadata, group, size);
+  // Which objects in the chunk the gc already zeroed
+  char zeroed[ALLOCATE_MANY_CHUNK_SIZE];
+  for (int first = 0; first < count; first = first + ALLOCATE_MANY_CHUNK_SIZE) {
+    int end = MIN(count, first + ALLOCATE_MANY_CHUNK_SIZE);
+    pthread_mutex_lock(&(group->free_lock));
+    for (int i = first; i < end; i++) {
+      GCPTR new = allocate_object(group);
+      if (new == NULL) {
+	out_of_memory("Heap", group->size);
+      }
+      zeroed[i - first] =
+	(0 == initialize_object_metadata(metadata, new, group, size));
+      out[i] = new + 1;
+    }
+    pthread_mutex_unlock(&(group->free_lock));
+    for (int i = first; i < end; i++) {
+      if (0 == zeroed[i - first]) {
+	initialize_object_body(metadata, out[i], body_size);
+      }
+    }
+  }
+}
+
+// Chains on a new static segment when full_segment, the current one,
+// can't fit another bytes. Allocators that lose the race to do it just
+// retry in the new segment.
+static
+void add_static_segment(int full_segment, long bytes) {
   pthread_mutex_lock(&static_frontier_ptr_lock);
-  // Static object headers are only 1 word long instead of 2 
-  LPTR ptr = (LPTR) static_frontier_ptr;
-  static_frontier_ptr = static_frontier_ptr + size + sizeof(long);
+  if (current_static_segment == full_segment) {
+    size_t segment_bytes = MAX(static_segment_bytes, (size_t) bytes);
+    segment_bytes = (segment_bytes + PAGE_ALIGNMENT_MASK) &
+      ~PAGE_ALIGNMENT_MASK;
+    if (allocate_segment(segment_bytes, STATIC_SEGMENT) == 0) {
+      out_of_memory("Static", bytes);
+    }
+    static_segment_bytes = 2 * segment_bytes;
+  }
+  pthread_mutex_unlock(&static_frontier_ptr_lock);
+}
 
-  if (static_frontier_ptr > last_static_ptr) {
-    out_of_memory("Static", size);
+// Static objects are bumped off the current static segment's frontier
+// with a compare and swap, no lock. The space is never reused and mmap
+// zero fills it, so bodies are already clear. The header goes in last,
+// a zero header tells the scanner its allocator isn't done yet. Nothing
+// between the compare and swap and the header store may lock, allocate
+// or otherwise wait on the gc, scan_static_space waits for the header
+// with no limit. As with RTallocate, size counts elements for metadata
+// objects.
+void *RTstatic_allocate(void *metadata, int size) {
+  long md = (long) metadata;
+  long body_size;
+  if (md < SC_METADATA) {
+    // At least a word, so a finished header is never 0
+    body_size = MAX(sizeof(long), ROUND_UPTO_LONG_ALIGNMENT(size));
   } else {
-    *ptr = (size << LINK_INFO_BITS);
-    if ((((long) metadata) <= SC_POINTERS) || (((long) metadata) == SC_CUSTOM1)) {
-      SET_STORAGE_CLASS(((GCPTR) (ptr - 1)), (long) metadata); 
-    } else {
-      Debugger("Add static support for SC_METADATA");
+    long data_size = (((RT_METADATA *) metadata)[0] * size) + sizeof(LPTR);
+    body_size = ROUND_UPTO_LONG_ALIGNMENT(data_size);
+  }
+  // Static object headers are only 1 word long instead of 2
+  long bytes = body_size + sizeof(long);
+
+  while (1) {
+    int segment = current_static_segment;
+    if (segment < 0) {
+      add_static_segment(segment, bytes);
+      continue;
+    }
+    BPTR frontier = segments[segment].frontier_ptr;
+    if ((frontier + bytes) > segments[segment].last_segment_ptr) {
+      add_static_segment(segment, bytes);
+    } else if (locked_long_cas((volatile long *)
+			       &(segments[segment].frontier_ptr),
+			       (long) frontier, (long) (frontier + bytes))) {
+      volatile long *header = (volatile long *) frontier;
+      LPTR body = (LPTR) (frontier + sizeof(long));
+      long storage_class = md;
+      if (md >= SC_METADATA) {
+	// Where scan_memory_segment_with_metadata looks for it
+	*((volatile long *) ((BPTR) body + body_size) - 1) = md;
+	storage_class = SC_METADATA;
+      }
+      *header = (body_size << LINK_INFO_BITS) | storage_class;
+      return(body);
     }
-    ptr = ptr + 1;
-    memset(ptr, 0, size);
-    pthread_mutex_unlock(&static_frontier_ptr_lock);
-    return(ptr);
   }
 }
 
@@ -419,6 +1205,14 @@ void init_saved_threads() {
   size_t stack_size = default_stack_size();
   for (int i = 0; i < MAX_THREADS; i++) {
     saved_threads[i].saved_stack_base = RTbig_malloc(stack_size);
+    if (NULL == saved_threads[i].saved_stack_base) {
+      out_of_memory("Saved stacks", stack_size / 1024);
+    }
+#if USE_THREAD_CACHES
+    saved_threads[i].saved_cache_objects =
+      RTbig_malloc(sizeof(GCPTR) * THREAD_CACHE_SIZE * (MAX_GROUP_INDEX + 1));
+#endif
+    saved_threads[i].saved_cache_count = 0;
   }
 }
 
@@ -426,35 +1220,81 @@ void RTinit_heap(size_t first_segment_bytes, size_t static_size) {
   enable_write_barrier = 0;
 
   printf("Default stacksize is %d\n", default_stack_size());
+  if ((RTpage_power < OS_PAGE_POWER) || (RTpage_power > MAX_PAGE_POWER)) {
+    printf("RTpage_power %d is out of range, using %d\n", RTpage_power,
+	   PAGE_POWER);
+    RTpage_power = PAGE_POWER;
+  }
+  RTpage_size = 1 << RTpage_power;
+  if (RTnuma_nodes <= 0) {
+    RTnuma_nodes = RTonline_numa_nodes();
+  }
+  RTnuma_nodes = MIN(RTnuma_nodes, MAX_NUMA_NODES);
+  numa_node_count = RTnuma_nodes;
+#if USE_PARALLEL_MARKING
+  if (RTmarker_threads <= 0) {
+    RTmarker_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  }
+  RTmarker_threads = MAX(1, MIN(RTmarker_threads, MAX_MARKER_THREADS));
+#else
+  RTmarker_threads = 1;
+#endif
+  if (0 != RTlock_memory) {
+    // madvise can't release locked pages
+    RTrelease_min_pages = 0;
+  }
     
-  total_partition_pages = first_segment_bytes / BYTES_PER_PAGE;
-  groups = RTbig_malloc(sizeof(GROUP_INFO) * (MAX_GROUP_INDEX + 1));
-  pages = RTbig_malloc(sizeof(PAGE_INFO) * total_partition_pages);
+  heap_reserve_pages = MAX(first_segment_bytes, RTheap_reserve_bytes) /
+    BYTES_PER_PAGE;
+  if (0 != RTuse_huge_pages) {
+    heap_reserve_pages = ROUND_UP_TO_HUGE_PAGE(heap_reserve_pages *
+					       BYTES_PER_PAGE) / BYTES_PER_PAGE;
+  }
+  total_partition_pages = 0;
+  groups = RTbig_malloc(sizeof(GROUP_INFO) * (LAST_GROUP_INDEX + 1));
+  pages = RTreserve_memory(sizeof(PAGE_INFO) * heap_reserve_pages);
+  page_bases = RTreserve_memory(sizeof(GCPTR) * heap_reserve_pages);
+  run_live_counts = RTreserve_memory(sizeof(int) * heap_reserve_pages);
+  dead_runs = RTreserve_memory(sizeof(int) * heap_reserve_pages);
   segments = RTbig_malloc(sizeof(SEGMENT) * MAX_SEGMENTS);
   threads = RTbig_malloc(sizeof(THREAD_INFO) * MAX_THREADS);
   saved_threads = RTbig_malloc(sizeof(THREAD_STATE) * MAX_THREADS);
   global_roots = RTbig_malloc(sizeof(char **) * MAX_GLOBAL_ROOTS);
-#if USE_BIT_WRITE_BARRIER
-  RTwrite_vector_length = first_segment_bytes / (MIN_GROUP_SIZE * BITS_PER_LONG);
-  RTwrite_vector = RTbig_malloc(RTwrite_vector_length * sizeof(long));
-  memset(RTwrite_vector, 0, RTwrite_vector_length * sizeof(long));
-  //printf("using bit write barrier, ");
-#else
-  RTwrite_vector_length = (total_partition_pages * 
-		       (BYTES_PER_PAGE / MIN_GROUP_SIZE));
-  RTwrite_vector = RTbig_malloc(RTwrite_vector_length);
-  memset(RTwrite_vector, 0, RTwrite_vector_length);
-  //printf("using byte write barrier, ");
-#endif
-  if ((pages == 0) || (groups == 0) || (segments == 0) || 
+  // Both grow with the heap
+  RTwrite_vector_length = 0;
+  RTwrite_vector = RTreserve_memory(heap_reserve_pages *
+				    WRITE_VECTOR_BYTES_PER_PAGE);
+  if ((pages == 0) || (page_bases == 0) || (run_live_counts == 0) ||
+      (dead_runs == 0) || (groups == 0) || (segments == 0) ||
       (threads == 0) || (global_roots == 0) || (RTwrite_vector == 0)) {
     out_of_memory("Heap Memory tables", 0);
   }
+#if USE_WRITE_VECTOR_SUMMARY
+  long words_per_page = WRITE_VECTOR_BYTES_PER_PAGE / sizeof(RTwrite_vector[0]);
+  write_vector_summary =
+    RTreserve_memory(sizeof(long) *
+		     WRITE_SUMMARY_LENGTH(heap_reserve_pages * words_per_page));
+  if (write_vector_summary == 0) {
+    out_of_memory("Write vector summary", 0);
+  }
+#endif
+#if USE_MARK_BITMAP
+  mark_bits = RTreserve_memory(heap_reserve_pages * MARK_BITS_BYTES_PER_PAGE);
+  if (mark_bits == 0) {
+    out_of_memory("Mark bitmap", 0);
+  }
+#endif
 
-  init_page_info();
-  empty_pages = NULL;
+  memset(empty_pages, 0, sizeof(empty_pages[0]) * HOLE_BINS);
+  memset(empty_bin_bits, 0, sizeof(empty_bin_bits[0]) * HOLE_BIN_WORDS);
+  for (int i = 0; i < HOLE_BINS; i++) {
+    empty_bin_oldest[i] = LONG_MAX;
+  }
+  empty_page_count = 0;
   init_mutator_threads();
   total_segments = 0;
+  static_segment_bytes = (static_size > 0) ? (2 * static_size) :
+    DEFAULT_STATIC_SEGMENT_SIZE;
   
   if ((static_size > 0) &&
       (allocate_segment(static_size, STATIC_SEGMENT) == 0)) {
@@ -470,6 +1310,9 @@ void RTinit_heap(size_t first_segment_bytes, size_t static_size) {
   init_saved_threads();
   init_group_info();
   init_realtime_gc();
+  if (0 != RTlock_memory) {
+    printf("Locked bytes = %ld\n", RTlocked_bytes());
+  }
 }
 
 static THREAD_INFO *alloc_thread() {
@@ -513,7 +1356,7 @@ static void free_thread(THREAD_INFO *thread) {
   }
   // Add thread to the head of free_threads list
   thread->next = free_threads;
-  free_threads->next = thread;
+  free_threads = thread;
   total_threads = total_threads - 1;
   pthread_mutex_unlock(&threads_lock);
 }
@@ -542,6 +1385,11 @@ void *rtalloc_start_thread(void *thread_arg) {
   thread->stack_bottom = (char *)  &stacksize;
   timerclear(&(thread->max_pause_tv));
   timerclear(&(thread->total_pause_tv));
+#if USE_THREAD_CACHES
+  // A reused THREAD_INFO may still hold the previous thread's cache.
+  // Those objects are simply garbage now.
+  reset_thread_caches(thread);
+#endif
   fflush(stdout);
   
   if (0 != pthread_setspecific(thread_key, (void *) thread)) {
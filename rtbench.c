@@ -0,0 +1,343 @@
+/*
+ * Copyright 2017 Wade Lawrence Hennessey
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// rtgc micro benchmarks. The gc runs on the initial thread, the
+// benchmark itself runs on an RTpthread_create'd driver thread.
+//
+// ./rtbench alloc [max_threads] [allocs_per_thread]
+//    allocation throughput scaling from 1 to max_threads mutators
+// ./rtbench many [batch_size] [total_allocs]
+//    RTallocate_many batches against a loop of RTallocate calls
+// ./rtbench mark [live_mb] [huge_pages] [cycles] [page_power] [markers]
+//    gc cycle time over a randomly linked live heap, huge_pages is the
+//    RTuse_huge_pages setting, page_power is RTpage_power and markers
+//    is RTmarker_threads
+// ./rtbench scan [threads] [depth] [reps]
+//    conservative scan filtering over the stack images the gc saved for
+//    threads sitting depth frames deep, word by word and with each of
+//    the SIMD range scan kernels
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include "info-bits.h"
+#include "mem-config.h"
+#include "mem-internals.h"
+#include "allocate.h"
+
+typedef struct node {
+  char *word;
+  int count;
+  struct node *lesser;
+  struct node *greater;
+} NODE;
+
+RT_METADATA NODE_md[] = {sizeof(NODE),
+			 offsetof(NODE, word),
+			 offsetof(NODE, lesser),
+			 offsetof(NODE, greater),
+			 -1};
+
+static int bench_argc;
+static char **bench_argv;
+
+static long arg_or_default(int index, long default_value) {
+  return((bench_argc > index) ? atol(bench_argv[index]) : default_value);
+}
+
+static double elapsed_seconds(struct timespec start, struct timespec end) {
+  struct timespec diff = RTtime_diff(end, start);
+  return(diff.tv_sec + (diff.tv_nsec / 1e9));
+}
+
+static volatile long alloc_go = 0;
+
+// Allocate the new_node/new_word pattern from a.c, keeping only a short
+// chain live so the gc has garbage to recycle.
+static void *alloc_thread(void *arg) {
+  long count = (long) arg;
+  NODE *live = NULL;
+  while (0 == alloc_go);
+  for (long i = 0; i < count; i++) {
+    char *word = RTallocate(RTnopointers, 8);
+    NODE *node = RTallocate(NODE_md, 1);
+    node->word = word;
+    node->count = 1;
+    if (0 == (i & 63)) {
+      live = NULL;
+    }
+    setf_init(node->lesser, live);
+    live = node;
+  }
+  return(NULL);
+}
+
+static void bench_alloc() {
+  int max_threads = arg_or_default(2, 4);
+  long allocs = arg_or_default(3, 1000000);
+  double base_rate = 0;
+
+  if (max_threads > (MAX_THREADS - 1)) {
+    max_threads = MAX_THREADS - 1;
+  }
+  printf("threads  allocs/sec   scaling\n");
+  for (int n = 1; n <= max_threads; n++) {
+    pthread_t pthreads[MAX_THREADS];
+    struct timespec start, end;
+    alloc_go = 0;
+    for (int i = 0; i < n; i++) {
+      RTpthread_create(&pthreads[i], NULL, &alloc_thread, (void *) allocs);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    alloc_go = 1;
+    for (int i = 0; i < n; i++) {
+      pthread_join(pthreads[i], NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    // Two RTallocate calls per iteration
+    double rate = (2.0 * allocs * n) / elapsed_seconds(start, end);
+    if (n == 1) {
+      base_rate = rate;
+    }
+    printf("%7d  %10.0f  %8.2f\n", n, rate, rate / base_rate);
+    fflush(stdout);
+  }
+}
+
+#define MAX_BATCH 4096
+
+static void bench_many() {
+  int batch = arg_or_default(2, 256);
+  long allocs = arg_or_default(3, 4000000);
+  void *objects[MAX_BATCH];
+  struct timespec start, end;
+
+  if (batch > MAX_BATCH) {
+    batch = MAX_BATCH;
+  }
+  long rounds = allocs / batch;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long r = 0; r < rounds; r++) {
+    for (int i = 0; i < batch; i++) {
+      objects[i] = RTallocate(NODE_md, 1);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double loop_rate = (rounds * batch) / elapsed_seconds(start, end);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (long r = 0; r < rounds; r++) {
+    RTallocate_many(NODE_md, 1, batch, objects);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  double many_rate = (rounds * batch) / elapsed_seconds(start, end);
+
+  printf("batch %d\n", batch);
+  printf("RTallocate loop  %10.0f allocs/sec\n", loop_rate);
+  printf("RTallocate_many  %10.0f allocs/sec  %.2fx\n",
+	 many_rate, many_rate / loop_rate);
+}
+
+// Every node points at the one before it, which keeps them all live,
+// and at a random older node, so marking jumps all over the heap.
+static void bench_mark() {
+  long live_mb = arg_or_default(2, 512);
+  int cycles = arg_or_default(4, 4);
+  NODE *node = RTallocate(NODE_md, 1);
+  // Count NODEs by the size of the group they land in, which takes in
+  // the header and metadata word, so live_mb is what they really use.
+  long node_bytes = PAGE_INDEX_TO_GROUP(PTR_TO_PAGE_INDEX(node))->size;
+  long node_count = (live_mb << 20) / node_bytes;
+  NODE **nodes = malloc(sizeof(NODE *) * node_count);
+  NODE *live = NULL;
+
+  srandom(1);
+  for (long i = 0; i < node_count; i++) {
+    if (i > 0) {
+      node = RTallocate(NODE_md, 1);
+    }
+    setf_init(node->lesser, live);
+    setf_init(node->greater, (i > 0) ? nodes[random() % i] : NULL);
+    nodes[i] = node;
+    live = node;
+  }
+  // Let the heap settle after growing, then time whole cycles
+  int start_count = rtgc_count() + 4;
+  while (rtgc_count() < start_count) {
+    usleep(100);
+  }
+  struct timespec start, end;
+  long start_mark_bytes = total_mark_bytes;
+  struct timeval start_mark_tv = total_mark_tv;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (rtgc_count() < (start_count + cycles)) {
+    usleep(100);
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  struct timeval mark_tv;
+  timersub(&total_mark_tv, &start_mark_tv, &mark_tv);
+  double mark_seconds = mark_tv.tv_sec + (mark_tv.tv_usec / 1e6);
+  printf("live %ld MB, huge pages %d, page size %d, markers %d\n", live_mb,
+	 RTuse_huge_pages, RTpage_size, RTmarker_threads);
+  printf("%d gc cycles, %.1f ms per cycle\n", cycles,
+	 (1000 * elapsed_seconds(start, end)) / cycles);
+  printf("marking %.1f ms per cycle, %.0f MB/s\n",
+	 (1000 * mark_seconds) / cycles,
+	 ((total_mark_bytes - start_mark_bytes) / mark_seconds) / (1 << 20));
+  // Keep the graph reachable from this stack until we're done
+  printf("%d\n", live->count);
+}
+
+#if USE_SIMD_RANGE_SCAN
+static volatile long scan_done = 0;
+
+// A frame with the usual mix of heap pointers, counters, doubles and
+// spilled return addresses on it, kept live across the call.
+static long stack_frame(int depth, NODE *node) {
+  NODE *locals[4];
+  long counts[4];
+  double ratio = depth / 3.0;
+  for (int i = 0; i < 4; i++) {
+    locals[i] = RTallocate(NODE_md, 1);
+    counts[i] = depth * i;
+  }
+  long total = 0;
+  if (depth > 0) {
+    total = stack_frame(depth - 1, locals[depth & 3]);
+  } else {
+    while (0 == scan_done) {
+      usleep(1000);
+    }
+  }
+  for (int i = 0; i < 4; i++) {
+    total = total + counts[i] + locals[i]->count;
+  }
+  return(total + (long) ratio + node->count);
+}
+
+static void *stack_thread(void *arg) {
+  long depth = (long) arg;
+  return((void *) stack_frame(depth, RTallocate(NODE_md, 1)));
+}
+
+static double time_kernel(int kernel, BPTR *images, long *sizes, int count,
+			  int reps, long *candidates) {
+  struct timespec start, end;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  for (int r = 0; r < reps; r++) {
+    *candidates = 0;
+    for (int i = 0; i < count; i++) {
+      *candidates = *candidates +
+	count_partition_words(images[i], images[i] + sizes[i], kernel);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return(elapsed_seconds(start, end));
+}
+
+static void bench_scan() {
+  int thread_count = arg_or_default(2, 8);
+  long depth = arg_or_default(3, 2000);
+  int reps = arg_or_default(4, 200);
+  pthread_t pthreads[MAX_THREADS];
+  BPTR images[MAX_THREADS];
+  long sizes[MAX_THREADS];
+  long words = 0;
+
+  if (thread_count > (MAX_THREADS - 2)) {
+    thread_count = MAX_THREADS - 2;
+  }
+  for (int i = 0; i < thread_count; i++) {
+    RTpthread_create(&pthreads[i], NULL, &stack_thread, (void *) depth);
+  }
+  // Copy the images right after a cycle starts, before the next flip
+  // can overwrite them.
+  int count = rtgc_count() + 4;
+  while (rtgc_count() < count) {
+    usleep(100);
+  }
+  int image_count = total_saved_threads;
+  for (int i = 0; i < image_count; i++) {
+    sizes[i] = saved_threads[i].saved_stack_size & ~(sizeof(long) - 1);
+    images[i] = malloc(sizes[i]);
+    memcpy(images[i], saved_threads[i].saved_stack_base, sizes[i]);
+    words = words + (sizes[i] / sizeof(long));
+  }
+  scan_done = 1;
+
+  long candidates;
+  double scalar = time_kernel(RANGE_SCAN_SCALAR, images, sizes, image_count,
+			      reps, &candidates);
+  printf("%d stack images, %ld words, %ld in the partition\n", image_count,
+	 words, candidates);
+  printf("scalar  %6.2f ns/word\n", (1e9 * scalar) / (words * reps));
+  double sse2 = time_kernel(RANGE_SCAN_SSE2, images, sizes, image_count,
+			    reps, &candidates);
+  printf("SSE2    %6.2f ns/word  %.2fx\n", (1e9 * sse2) / (words * reps),
+	 scalar / sse2);
+  if (RANGE_SCAN_AVX2 == range_scan_kernel) {
+    double avx2 = time_kernel(RANGE_SCAN_AVX2, images, sizes, image_count,
+			      reps, &candidates);
+    printf("AVX2    %6.2f ns/word  %.2fx\n", (1e9 * avx2) / (words * reps),
+	   scalar / avx2);
+  }
+}
+#endif
+
+static void *bench_driver(void *arg) {
+  char *mode = (bench_argc > 1) ? bench_argv[1] : "alloc";
+  if (0 == strcmp(mode, "alloc")) {
+    bench_alloc();
+  } else if (0 == strcmp(mode, "many")) {
+    bench_many();
+  } else if (0 == strcmp(mode, "mark")) {
+    bench_mark();
+#if USE_SIMD_RANGE_SCAN
+  } else if (0 == strcmp(mode, "scan")) {
+    bench_scan();
+#endif
+  } else {
+    printf("Unknown benchmark %s\n", mode);
+  }
+  exit(0);
+}
+
+int main(int argc, char *argv[]) {
+  bench_argc = argc;
+  bench_argv = argv;
+  RTatomic_gc = 0;
+  if ((argc > 3) && (0 == strcmp(argv[1], "mark"))) {
+    RTuse_huge_pages = atoi(argv[3]);
+  }
+  if ((argc > 5) && (0 == strcmp(argv[1], "mark"))) {
+    RTpage_power = atoi(argv[5]);
+  }
+  if ((argc > 6) && (0 == strcmp(argv[1], "mark"))) {
+    RTmarker_threads = atoi(argv[6]);
+  }
+  RTinit_heap((1L << 26), 1L << 18);
+  pthread_t thread;
+  RTpthread_create(&thread, NULL, &bench_driver, 0);
+  rtgc_loop();
+}
@@ -22,7 +22,11 @@
 #include <string.h>
 #include <ctype.h>
 #include <assert.h>
+#include <limits.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include <unistd.h>
 #include <semaphore.h>
 #include <pthread.h>
@@ -36,24 +40,25 @@ static void verify_heap() {
   lock_all_free_locks();
   int page = 0;
   while (page < total_partition_pages) {
-    GPTR group = pages[page].group;
+    GPTR group = PAGE_INDEX_TO_GROUP(page);
+#if USE_LARGE_OBJECT_SPACE
+    if (group == LARGE_GROUP) {
+      page = page + 1;
+      continue;
+    }
+#endif
     if (group > EXTERNAL_PAGE) {
-      if (group->size <= BYTES_PER_PAGE) {
-	//identify_single_free_page(page, group);
-	page = page + 1;
-      } else {
-	//page = identify_multiple_free_pages(page, group);
-	//page = page + (group->size / BYTES_PER_PAGE);
-	BPTR page_base = PAGE_INDEX_TO_PTR(page);
-	GCPTR gcptr = (GCPTR) page_base;
+      GCPTR gcptr = PAGE_INDEX_TO_RUN_BASE(page, group);
+      assert(gcptr == (GCPTR) PAGE_INDEX_TO_PTR(page));
+      if (group->run_objects == 1) {
 	if (gcptr->prev > (GCPTR) 16) {
 	  assert(gcptr->prev >= (GCPTR) first_partition_ptr);
 	}
 	if (gcptr->next > (GCPTR) 16) {
 	  assert(gcptr->next >= (GCPTR) first_partition_ptr);
 	}
-	page = page + (group->size / BYTES_PER_PAGE);
       }
+      page = page + group->run_pages;
     } else {
       page = page + 1;
     }
@@ -61,30 +66,15 @@ static void verify_heap() {
   unlock_all_free_locks();
 }
 
-static void coalesce_free_pages() {
-  long next_page = 0;
-  long hole = -1;
-  long page_count;
-  while (next_page < total_partition_pages) {
-    if (pages[next_page].group == FREE_PAGE) {
-      if (-1 == hole) {
-	hole = next_page;
-	page_count = 1;
-      } else {
-	page_count = page_count + 1;
-      }
-    } else {
-      if (-1 != hole) {
-	RTinit_empty_pages(hole, page_count, HEAP_SEGMENT);
-	hole = -1;
-	page_count = 0;
-      }
-    }
-    next_page = next_page + 1;
-  }
-  if (-1 != hole) {
-    RTinit_empty_pages(hole, page_count, HEAP_SEGMENT);
-  }
+// Runs on dead_runs, the gc thread is the only one that touches it
+static long dead_run_count = 0;
+
+// Called by recycle_group_garbage, holding the group's free_lock, when
+// the last live object in the run starting at page dies.
+void queue_dead_run(long page) {
+  run_live_counts[page] = DEAD_RUN_QUEUED;
+  dead_runs[dead_run_count] = page;
+  dead_run_count = dead_run_count + 1;
 }
 
 
@@ -108,6 +98,20 @@ static void remove_object_from_free_list(GPTR group, GCPTR object) {
     group->last = ((next == NULL) ? prev : next);
   }
 
+  if (numa_node_count > 1) {
+    int node = pages[PTR_TO_PAGE_INDEX(object)].node;
+    if (object == group->node_free[node]) {
+      if (object == group->node_last[node]) {
+	group->node_free[node] = NULL;
+	group->node_last[node] = NULL;
+      } else {
+	group->node_free[node] = next;
+      }
+    } else if (object == group->node_last[node]) {
+      group->node_last[node] = prev;
+    }
+  }
+
   if (prev != NULL) {
     SET_LINK_POINTER(prev->next, next);
   }
@@ -116,13 +120,14 @@ static void remove_object_from_free_list(GPTR group, GCPTR object) {
   }
 }
 
-static int all_green_page(int page, GPTR group) {
-  BPTR page_base = PAGE_INDEX_TO_PTR(page);
-  BPTR next_object = page_base;
+#ifndef NDEBUG
+// Only free_run's assert uses this
+static int all_green_run(int page, GPTR group) {
+  BPTR next_object = PAGE_INDEX_TO_PTR(page);
   int all_green = 1;
-  while (all_green && (next_object < (page_base + BYTES_PER_PAGE))) {
+  for (int i = 0; all_green && (i < group->run_objects); i++) {
     GCPTR gcptr = (GCPTR) next_object;
-    if (all_green && GREENP(gcptr)) {
+    if (GREENP(gcptr)) {
       next_object = next_object + group->size;
     } else {
       all_green = 0;
@@ -130,155 +135,214 @@ static int all_green_page(int page, GPTR group) {
   }
   return(all_green);
 }
+#endif
 
-static void identify_single_free_page(int page, GPTR group) {
-  if (all_green_page(page, group)) {
-    pthread_mutex_lock(&(group->free_lock));
-    if (all_green_page(page, group)) {
-      GCPTR next = (GCPTR) PAGE_INDEX_TO_PTR(page);
-      // remove all objects on page from free list
-      int object_count = BYTES_PER_PAGE / group->size;
-      for (int i = 0; i < object_count; i++) {
-	remove_object_from_free_list(group, next);
-	next = (GCPTR) ((BPTR) next + group->size);
-      }
-      pages[page].group = 0;
-      pages[page].group = FREE_PAGE;
-      // HEY! conditionalize this clear page - just here to catch bugs
-      //memset(PAGE_INDEX_TO_PTR(page), 0xEF, BYTES_PER_PAGE);
+// Runs overlapping one of a group's fresh regions still hold uncarved
+// objects. Only an allocator holding the group's free_lock moves them.
+static int fresh_run(int page, GPTR group) {
+  BPTR run_base = PAGE_INDEX_TO_PTR(page);
+  BPTR run_end = run_base + (group->run_pages * BYTES_PER_PAGE);
+  for (int i = 0; i < numa_node_count; i++) {
+    if ((run_end > group->regions[i].fresh) &&
+	(run_base < group->regions[i].fresh_limit)) {
+      return(1);
     }
-    pthread_mutex_unlock(&(group->free_lock));
   }
+  return(0);
 }
 
-// Return base page index, even if page is somewhere in the middle of object.
-static int identify_multiple_free_pages(int page, GPTR group) {
-  BPTR page_base = PAGE_INDEX_TO_PTR(page);
-  GCPTR gcptr = (GCPTR) page_base;
-  if (pages[page].base == gcptr) {
-    // Getting here means we've found the start of a multi-page object
-    if (GREENP(gcptr)) {
-      pthread_mutex_lock(&(group->free_lock));
-      if (GREENP(gcptr)) {
-	int num_pages = group->size / BYTES_PER_PAGE;
-	remove_object_from_free_list(group, gcptr);
-	for (int i = 0; i < num_pages; i++) {
-	  pages[page + i].base = 0;
-	  pages[page + i].group = FREE_PAGE;
-	  // HEY! conditionalize this clear page - just here to catch bugs
-	  //memset(PAGE_INDEX_TO_PTR(page + i), 0, BYTES_PER_PAGE);
-	}
-      }
-      pthread_mutex_unlock(&(group->free_lock));
-    }
-  } else {
-    // Getting here means we've run into a race condition with a multi-page
-    // object allocation. We passed the base page when the page was still
-    // empty, but the object got allocated and now we need to jump past it.
-    assert(pages[page].base < gcptr);
-    printf("mapping race page %d to base ptr %p\n", page, pages[page].base);
-    page = PTR_TO_PAGE_INDEX(pages[page].base);
+// Caller must hold the group->free_lock. Takes every object in the
+// run off the free list and hides its pages from the scanners.
+static void free_run(int page, GPTR group) {
+  assert(all_green_run(page, group));
+  GCPTR next = (GCPTR) PAGE_INDEX_TO_PTR(page);
+  for (int i = 0; i < group->run_objects; i++) {
+    remove_object_from_free_list(group, next);
+    next = (GCPTR) ((BPTR) next + group->size);
+  }
+  for (int i = 0; i < group->run_pages; i++) {
+    SET_PAGE_GROUP(page + i, FREE_PAGE);
+    // HEY! conditionalize this clear page - just here to catch bugs
+    //memset(PAGE_INDEX_TO_PTR(page + i), 0xEF, BYTES_PER_PAGE);
   }
-  return(page);
 }
 
-void identify_free_pages() {
-  int page = 0;
-  while (page < total_partition_pages) {
-    GPTR group = pages[page].group;
-    if (group > EXTERNAL_PAGE) {
-      if (group->size <= BYTES_PER_PAGE) {
-	identify_single_free_page(page, group);
-	page = page + 1;
-      } else {
-	page = identify_multiple_free_pages(page, group);
-	page = page + (group->size / BYTES_PER_PAGE);
-	//page = page + 1;
-      }
+// Only the runs recycling emptied are looked at, so this costs what
+// was freed rather than the size of the heap. An allocator may have
+// taken an object from a queued run since, and runs in their group's
+// fresh region stay queued until the region moves on.
+static void identify_free_pages() {
+  long kept = 0;
+  for (long i = 0; i < dead_run_count; i++) {
+    int page = dead_runs[i];
+    GPTR group = PAGE_INDEX_TO_GROUP(page);
+    int freed = 0;
+    assert(group > EXTERNAL_PAGE);
+    pthread_mutex_lock(&(group->free_lock));
+    if (fresh_run(page, group)) {
+      dead_runs[kept] = page;
+      kept = kept + 1;
     } else {
-      page = page + 1;
+      run_live_counts[page] = run_live_counts[page] - DEAD_RUN_QUEUED;
+      if (0 == run_live_counts[page]) {
+	free_run(page, group);
+	freed = 1;
+      }
+    }
+    pthread_mutex_unlock(&(group->free_lock));
+    if (freed) {
+      add_free_pages(page, group->run_pages);
     }
   }
+  dead_run_count = kept;
 }
 
-void RTroom_print(long *green_count, long *alloc_count, long *hole_counts) {
+void RTroom_print(long *green_count, long *alloc_count, long *fresh_count,
+		  long *partial_count, long *partial_green_count,
+		  long large_count, long large_bytes, long *hole_counts,
+		  long page_count) {
   long total_empty_pages = 0;
   printf("----------------------------------------------------------------\n");
-  for (long i = 0; i < (total_partition_pages + 1); i++) {
+  for (long i = 0; i < (page_count + 1); i++) {
     if (hole_counts[i] > 0) {
-      printf("Hole size = %d: %d\n", i, hole_counts[i]);
+      printf("Hole size = %ld: %ld\n", i, hole_counts[i]);
     }
     total_empty_pages = total_empty_pages + (hole_counts[i] * i);
   }
-  printf("Total hole bytes = %d\n", total_empty_pages * BYTES_PER_PAGE);
+  printf("Total hole bytes = %ld\n", total_empty_pages * BYTES_PER_PAGE);
   long total_committed_bytes = 0;
   for (int i = MIN_GROUP_INDEX; i <= MAX_GROUP_INDEX; i = i + 1) {
-    if ((green_count[i] > 0) || (alloc_count[i] > 0)) {
-      long total_group_bytes = 	((alloc_count[i] +  green_count[i]) * 
-				 groups[i].size);
-      printf("Group size = %d: allocated: %d, free: %d, total_bytes = %d\n",
+    if ((green_count[i] > 0) || (alloc_count[i] > 0) || (fresh_count[i] > 0)) {
+      long total_group_bytes = 	((alloc_count[i] +  green_count[i] +
+				  fresh_count[i]) * groups[i].size);
+      printf("Group size = %d: allocated: %ld, free: %ld, fresh: %ld, "
+	     "total_bytes = %ld\n",
 	     groups[i].size, 
 	     alloc_count[i], 
 	     green_count[i],
+	     fresh_count[i],
 	     total_group_bytes);
+      // Free objects stuck in runs that still hold live ones
+      printf("    partial runs: %ld, free objects in them: %ld (%ld%%)\n",
+	     partial_count[i], partial_green_count[i],
+	     (green_count[i] > 0) ?
+	     ((100 * partial_green_count[i]) / green_count[i]) : 0);
+      printf("    refills: %ld, refill pages: %ld, next refill runs: %d\n",
+	     groups[i].refill_count,
+	     groups[i].refill_page_count,
+	     groups[i].refill_runs);
       total_committed_bytes = total_committed_bytes + total_group_bytes;
     }
   }
-  printf("Total committed bytes = %d\n", total_committed_bytes);
-  printf("Total hole + committed bytes = %d (max %d)\n", 
+  if (large_count > 0) {
+    printf("Large objects: %ld, total_bytes = %ld\n", large_count, large_bytes);
+    total_committed_bytes = total_committed_bytes + large_bytes;
+  }
+  printf("Total committed bytes = %ld\n", total_committed_bytes);
+  printf("Total hole + committed bytes = %ld (max %ld)\n", 
 	 (total_empty_pages * BYTES_PER_PAGE) + total_committed_bytes,
-	 total_partition_pages * BYTES_PER_PAGE);
-  printf("Static space allocated bytes = %d\n", 
-	 static_frontier_ptr - first_static_ptr);
+	 page_count * BYTES_PER_PAGE);
+  long static_bytes = 0;
+  for (int i = 0; i < total_segments; i++) {
+    if (segments[i].type == STATIC_SEGMENT) {
+      static_bytes = static_bytes +
+	(segments[i].frontier_ptr - segments[i].first_segment_ptr);
+    }
+  }
+  printf("Static space allocated bytes = %ld\n", static_bytes);
+  long released_bytes = 0;
+  pthread_mutex_lock(&empty_pages_lock);
+  for (int bin = first_hole_bin(0); bin >= 0; bin = first_hole_bin(bin + 1)) {
+    for (HOLE_PTR hole = empty_pages[bin]; hole != NULL; hole = hole->next) {
+      // The header's page is never released
+      long unreleased = hole->unreleased_end - hole->unreleased_first +
+	((hole->unreleased_first > 0) ? 1 : 0);
+      released_bytes = released_bytes +
+	((hole->page_count - MAX(1, unreleased)) * BYTES_PER_PAGE);
+    }
+  }
+  pthread_mutex_unlock(&empty_pages_lock);
+  printf("Released hole bytes = %ld\n", released_bytes);
+  printf("Resident heap bytes = %ld (committed %ld)\n",
+	 RTresident_bytes(first_partition_ptr, page_count * BYTES_PER_PAGE),
+	 page_count * BYTES_PER_PAGE);
+  printf("Locked bytes = %ld\n", RTlocked_bytes());
+  double mark_seconds = total_mark_tv.tv_sec + (total_mark_tv.tv_usec / 1e6);
+  printf("Marked bytes = %ld in %.3f s (%.0f MB/s), longest mark %ld us\n",
+	 total_mark_bytes, mark_seconds,
+	 (mark_seconds > 0) ? (total_mark_bytes / mark_seconds) / (1 << 20) : 0,
+	 (max_mark_tv.tv_sec * 1000000) + max_mark_tv.tv_usec);
   printf("----------------------------------------------------------------\n");
 }
 
 void RTroom() {
   long green_count[MAX_GROUP_INDEX + 1];
   long alloc_count[MAX_GROUP_INDEX + 1];
-  long hole_counts_len = (total_partition_pages + 1) * sizeof(long);
-  // HEY! should malloc this
-  long hole_counts[hole_counts_len];
+  long fresh_count[MAX_GROUP_INDEX + 1];
+  long partial_count[MAX_GROUP_INDEX + 1];
+  long partial_green_count[MAX_GROUP_INDEX + 1];
+  long large_count = 0;
+  long large_bytes = 0;
   memset(green_count, 0, sizeof(green_count));
   memset(alloc_count, 0, sizeof(alloc_count));
-  memset(hole_counts, 0, hole_counts_len);
+  memset(fresh_count, 0, sizeof(fresh_count));
+  memset(partial_count, 0, sizeof(partial_count));
+  memset(partial_green_count, 0, sizeof(partial_green_count));
   int page = 0;
   int hole_len = 0;
   lock_all_free_locks();
-  while (page < total_partition_pages) {
-    GPTR group = pages[page].group;
+  // The gc can grow the heap while we walk it, just report on the
+  // pages there were when we started.
+  long page_count = total_partition_pages;
+  long *hole_counts = calloc(page_count + 1, sizeof(long));
+  while (page < page_count) {
+    GPTR group = PAGE_INDEX_TO_GROUP(page);
+    if ((group > EXTERNAL_PAGE) && (hole_len > 0)) {
+      hole_counts[hole_len] = hole_counts[hole_len] + 1;
+      hole_len = 0;
+    }
+#if USE_LARGE_OBJECT_SPACE
+    if (group == LARGE_GROUP) {
+      GCPTR gcptr = page_bases[page];
+      large_count = large_count + 1;
+      large_bytes = large_bytes + 
+	(LARGE_OBJECT_PAGES(LARGE_OBJECT_SIZE(gcptr)) * BYTES_PER_PAGE);
+      page = PTR_TO_PAGE_INDEX(gcptr) +
+	LARGE_OBJECT_PAGES(LARGE_OBJECT_SIZE(gcptr));
+      continue;
+    }
+#endif
     if (group > EXTERNAL_PAGE) {
-      if (hole_len > 0) {
-	hole_counts[hole_len] = hole_counts[hole_len] + 1;
-	hole_len = 0;
-      }
       GCPTR next = (GCPTR) PAGE_INDEX_TO_PTR(page);
-      if (group->size <= BYTES_PER_PAGE) {
-	int object_count = BYTES_PER_PAGE / group->size;
-	int green = 0;
-	int alloc = 0;
-	for (int i = 0; i < object_count; i++) {
-	  if (GREENP(next)) {
-	    green = green + 1;
-	  } else {
-	    alloc = alloc + 1;
-	  }
-	  next = (GCPTR) ((BPTR) next + group->size);
-	}
-	green_count[group->index] = green_count[group->index] + green;
-	alloc_count[group->index] = alloc_count[group->index] + alloc;
-	page = page + 1;
-      } else {
-	if (GREENP(next)) {
-	  printf("HEY! shouldn't see green multi page objects after coalesce!\n");
-	  green_count[group->index] = green_count[group->index] + 1;
+      int green = 0;
+      int alloc = 0;
+      int fresh = 0;
+      for (int i = 0; i < group->run_objects; i++) {
+	if (!CARVED_OBJECT(next, group)) {
+	  fresh = fresh + 1;
+	} else if (GREENP(next)) {
+	  green = green + 1;
 	} else {
-	  alloc_count[group->index] = alloc_count[group->index] + 1;
+	  alloc = alloc + 1;
 	}
-	page = page + (group->size / BYTES_PER_PAGE);
+	next = (GCPTR) ((BPTR) next + group->size);
+      }
+      if ((group->run_objects == 1) && (green > 0)) {
+	printf("HEY! shouldn't see green multi page objects after coalesce!\n");
+      }
+      green_count[group->index] = green_count[group->index] + green;
+      alloc_count[group->index] = alloc_count[group->index] + alloc;
+      fresh_count[group->index] = fresh_count[group->index] + fresh;
+      if ((green > 0) && (alloc > 0)) {
+	partial_count[group->index] = partial_count[group->index] + 1;
+	partial_green_count[group->index] =
+	  partial_green_count[group->index] + green;
       }
+      page = page + group->run_pages;
     } else {
-      if (group != EMPTY_PAGE) {
+      // FREE_PAGEs are garbage that the coalescer hasn't turned into
+      // holes yet, or the ends of holes it's releasing.
+      if ((group != EMPTY_PAGE) && (group != FREE_PAGE)) {
 	Debugger("Should have found an EMPTY_PAGE!\n");
       }
       hole_len = hole_len + 1;
@@ -289,63 +353,203 @@ void RTroom() {
     hole_counts[hole_len] = hole_counts[hole_len] + 1;
   }
   unlock_all_free_locks();
-  RTroom_print(green_count, alloc_count, hole_counts);
+  RTroom_print(green_count, alloc_count, fresh_count, partial_count,
+	       partial_green_count, large_count, large_bytes, hole_counts,
+	       page_count);
+  free(hole_counts);
 }
 
-// Caller must hold empty_pages_lock when calling this.
-void delete_merged_holes(int delete_count) {
-  HOLE_PTR prev = NULL;
-  HOLE_PTR next = empty_pages;
-  while ((delete_count > 0) && (next != NULL)) {
-    if (next->page_count == 0) {
-      if (prev == NULL) {
-	empty_pages = next->next;
-	next = empty_pages;
-      } else {
-	next = next->next;
-	prev->next = next;
+// Give the unreleased pages of holes that have been empty for a while
+// back to the kernel. This runs after coalescing, so allocators never
+// pay for it. Reused pages fault back in zero filled. Up to
+// COALESCE_BATCH_SIZE holes at a time are taken out of the pool and
+// madvised without the empty_pages_lock, then put back. Only bins whose
+// oldest unreleased hole is old enough are walked, and a walk that gets
+// through a bin tightens that age for the holes left in it.
+static
+void release_idle_holes() {
+  int advice = MADV_DONTNEED;
+#ifdef MADV_FREE
+  if (RTrelease_use_madv_free) {
+    advice = MADV_FREE;
+  }
+#endif
+  int min_pages = MAX(2, RTrelease_min_pages);
+  HOLE_PTR batch[COALESCE_BATCH_SIZE];
+  int count;
+  do {
+    count = 0;
+    pthread_mutex_lock(&empty_pages_lock);
+    // Bins below the threshold's own bin only hold smaller holes
+    int bin = first_hole_bin(hole_bin(min_pages));
+    for (; (bin >= 0) && (count < COALESCE_BATCH_SIZE);
+	 bin = first_hole_bin(bin + 1)) {
+      if ((gc_count - empty_bin_oldest[bin]) < RTrelease_age) {
+	continue;
       }
-      delete_count = delete_count - 1;
-    } else {
-      prev = next;
-      next = next->next;
+      long oldest = LONG_MAX;
+      HOLE_PTR next = empty_pages[bin];
+      while ((next != NULL) && (count < COALESCE_BATCH_SIZE)) {
+	HOLE_PTR hole = next;
+	next = hole->next;
+	if ((hole->unreleased_first == hole->unreleased_end) ||
+	    (hole->page_count < min_pages)) {
+	  continue;
+	}
+	if ((gc_count - hole->empty_since) < RTrelease_age) {
+	  oldest = MIN(oldest, hole->empty_since);
+	} else {
+	  take_hole(hole);
+	  batch[count] = hole;
+	  count = count + 1;
+	}
+      }
+      if (NULL == next) {
+	empty_bin_oldest[bin] = oldest;
+      }
+    }
+    pthread_mutex_unlock(&empty_pages_lock);
+
+    for (int i = 0; i < count; i++) {
+      HOLE_PTR hole = batch[i];
+      BPTR low = (BPTR) hole + MAX(OS_PAGE_BYTES,
+				   hole->unreleased_first * BYTES_PER_PAGE);
+      BPTR high = (BPTR) hole + (hole->unreleased_end * BYTES_PER_PAGE);
+      if (0 != RTuse_huge_pages) {
+	// Only whole huge pages, releasing part of one would split it
+	low = (BPTR) ROUND_UP_TO_HUGE_PAGE(low);
+	high = (BPTR) ROUND_DOWN_TO_HUGE_PAGE(high);
+      }
+      if (high > low) {
+	madvise(low, high - low, advice);
+      }
+      hole->unreleased_first = 0;
+      hole->unreleased_end = 0;
     }
+
+    if (count > 0) {
+      pthread_mutex_lock(&empty_pages_lock);
+      for (int i = 0; i < count; i++) {
+	return_hole(batch[i]);
+      }
+      pthread_mutex_unlock(&empty_pages_lock);
+    }
+  } while (COALESCE_BATCH_SIZE == count);
+}
+
+// Freed pages wait here, threaded through hole headers on their first
+// pages, until they're merged into the empty page pool. They only come
+// off the list under the empty_pages_lock and are merged before it's
+// dropped, so whoever holds that lock finds every freed page either
+// here or in a hole.
+static HOLE_PTR pending_holes = NULL;
+static pthread_mutex_t pending_holes_lock = PTHREAD_MUTEX_INITIALIZER;
+// Only guards coalesce_requested, nobody holds it while they work
+static pthread_mutex_t coalesce_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t coalesce_cond = PTHREAD_COND_INITIALIZER;
+static int coalesce_requested = 0;
+static int coalescer_running = 0;
+
+// The pages must already be FREE_PAGEs, so nothing else looks at them
+// until they're holes.
+void add_free_pages(int first_page, int page_count) {
+  if (0 == coalescer_running) {
+    RTinit_empty_pages(first_page, page_count, HEAP_SEGMENT);
+    return;
   }
-  assert(delete_count == 0);
+  HOLE_PTR hole = (HOLE_PTR) PAGE_INDEX_TO_PTR(first_page);
+  hole->page_count = page_count;
+  pthread_mutex_lock(&pending_holes_lock);
+  hole->next = pending_holes;
+  pending_holes = hole;
+  pthread_mutex_unlock(&pending_holes_lock);
 }
 
-void merge_adjacent_holes() {
-  int merge_count = 0;
-  pthread_mutex_lock(&empty_pages_lock);
-  HOLE_PTR next = empty_pages;
-  while (next != NULL) {
-    // Skip merged holes with 0 page_counts
-    if (next->page_count > 0) {
-      int start_page = PTR_TO_PAGE_INDEX(next);
-      int continue_merge;
-      do {
-	continue_merge = 0;
-	int end_page = start_page + next->page_count;
-	if (end_page < total_partition_pages) {
-	  if (pages[end_page].group == EMPTY_PAGE) {
-	    HOLE_PTR adjacent = (HOLE_PTR) PAGE_INDEX_TO_PTR(end_page);
-	    next->page_count = next->page_count + adjacent->page_count;
-	    adjacent->page_count = 0;
-	    merge_count = merge_count + 1;
-	    continue_merge = 1;
-	  }
-	}
-      } while (continue_merge == 1);
+// Merges the pending holes into the pool, holding the empty_pages_lock
+// for COALESCE_BATCH_SIZE of them at a time.
+static
+void merge_pending_holes() {
+  int count;
+  do {
+    count = 0;
+    pthread_mutex_lock(&empty_pages_lock);
+    pthread_mutex_lock(&pending_holes_lock);
+    HOLE_PTR batch = pending_holes;
+    HOLE_PTR last = NULL;
+    HOLE_PTR next = pending_holes;
+    while ((next != NULL) && (count < COALESCE_BATCH_SIZE)) {
+      last = next;
+      next = next->next;
+      count = count + 1;
+    }
+    pending_holes = next;
+    if (last != NULL) {
+      last->next = NULL;
+    }
+    pthread_mutex_unlock(&pending_holes_lock);
+    while (batch != NULL) {
+      HOLE_PTR hole = batch;
+      batch = hole->next;
+      add_empty_pages(PTR_TO_PAGE_INDEX(hole), hole->page_count);
+    }
+    pthread_mutex_unlock(&empty_pages_lock);
+  } while (COALESCE_BATCH_SIZE == count);
+}
+
+static
+void *coalescer_loop(void *arg) {
+  // Nice values are per thread, and a new one starts with its creator's
+  pid_t tid = syscall(SYS_gettid);
+  setpriority(PRIO_PROCESS, tid,
+	      getpriority(PRIO_PROCESS, tid) + COALESCER_NICE);
+  while (1) {
+    pthread_mutex_lock(&coalesce_lock);
+    while (0 == coalesce_requested) {
+      pthread_cond_wait(&coalesce_cond, &coalesce_lock);
+    }
+    coalesce_requested = 0;
+    pthread_mutex_unlock(&coalesce_lock);
+    merge_pending_holes();
+    if (RTrelease_min_pages > 0) {
+      release_idle_holes();
     }
-    next = next->next;
   }
-  delete_merged_holes(merge_count);
-  pthread_mutex_unlock(&empty_pages_lock);
+  return(NULL);
 }
 
+// The coalescer isn't an RTpthread, it never touches gc objects, so
+// flips don't have to stop it.
+void init_coalescer() {
+#if USE_COALESCER_THREAD
+  pthread_t thread;
+  if (0 != pthread_create(&thread, NULL, &coalescer_loop, NULL)) {
+    Debugger("coalescer thread create failed!\n");
+  }
+  coalescer_running = 1;
+#endif
+}
 
+// Only the treadmill work runs on the gc thread, since the marker edits
+// the treadmill without the free_locks. Pages the coalescer hasn't
+// merged yet from the last cycle are merged here first, a batch at a
+// time like the coalescer does, so pages freed by a cycle are always
+// holes by the end of the next one, which is as long as
+// wait_for_empty_pages waits. The gc never waits for the coalescer to
+// finish anything, only for the empty_pages_lock, and nobody holds that
+// for more than a batch.
 void coalesce_all_free_pages() {
+  if (coalescer_running) {
+    merge_pending_holes();
+  }
   identify_free_pages();
-  coalesce_free_pages();
-  merge_adjacent_holes();
+  if (0 == coalescer_running) {
+    if (RTrelease_min_pages > 0) {
+      release_idle_holes();
+    }
+  } else {
+    pthread_mutex_lock(&coalesce_lock);
+    coalesce_requested = 1;
+    pthread_cond_signal(&coalesce_cond);
+    pthread_mutex_unlock(&coalesce_lock);
+  }
 }
@@ -27,16 +27,25 @@
 #include <semaphore.h>
 #include <pthread.h>
 #include <signal.h>
+#include <limits.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include "mem-config.h"
 #include "info-bits.h"
 #include "mem-internals.h"
 #include "allocate.h"
+#if USE_SIMD_RANGE_SCAN
+#include <immintrin.h>
+#endif
 
 struct timeval max_flip_tv, total_flip_tv;
 
-static
-void RTmake_object_gray(GCPTR current) {
-  GPTR group = PTR_TO_GROUP(current);
+// Moves current from the white list onto the front of the gray set.
+// This give us a breadth first search when scanning the gray set (not
+// that it matters)
+static inline
+void link_gray_object(GPTR group, GCPTR current) {
   GCPTR prev = GET_LINK_POINTER(current->prev);
   GCPTR next = GET_LINK_POINTER(current->next);
 
@@ -51,8 +60,6 @@ void RTmake_object_gray(GCPTR current) {
     SET_LINK_POINTER(next->prev, prev);
   }
 
-  // Link current onto the end of the gray set. This give us a breadth
-  // first search when scanning the gray set (not that it matters)
   SET_LINK_POINTER(current->prev, NULL);
   GCPTR gray = group->gray;
   if (gray == NULL) {
@@ -74,41 +81,91 @@ void RTmake_object_gray(GCPTR current) {
     SET_LINK_POINTER(current->next, gray);
     SET_LINK_POINTER(gray->prev, current);
   }
-  assert(WHITEP(current));
-  SET_COLOR(current, GRAY);
   group->gray = current;
   assert(group->white_count > 0); // no lock needed, white_count is gc only
   DEBUG(group->white_count = group->white_count - 1);
 }
 
+#if USE_MARK_BITMAP
+#if !USE_PARALLEL_MARKING
+#error "USE_MARK_BITMAP needs USE_PARALLEL_MARKING"
+#endif
+// Whichever marker sets the object's mark bit gets to push it, the
+// header and the treadmill links are left alone.
+static
+void RTmake_object_gray(GCPTR current) {
+  long index = MARK_BIT_INDEX(current);
+  if (0 == locked_long_bts(MARK_BIT_PAIR(current) + mark_word,
+			   index % BITS_PER_LONG)) {
+    push_mark_entry((BPTR) current, NULL, NULL);
+  }
+}
+#elif USE_PARALLEL_MARKING
+// Another marker can find the same white object at the same time, so
+// the color is checked again under the gray_lock, which covers the
+// white and gray links too. Objects are marked as soon as they're
+// claimed, being on a marker's deque is what makes them gray, so
+// scanning never has to touch the header again.
+static
+void RTmake_object_gray(GCPTR current) {
+  GPTR group = PTR_TO_GROUP(current);
+  if (1 == marker_count) {
+    link_gray_object(group, current);
+    SET_COLOR(current, marked_color);
+    DEBUG(group->black_scanned_count = group->black_scanned_count + 1);
+  } else {
+    pthread_mutex_lock(&(group->gray_lock));
+    if (!WHITEP(current)) {
+      pthread_mutex_unlock(&(group->gray_lock));
+      return;
+    }
+    link_gray_object(group, current);
+    SET_COLOR(current, marked_color);
+    DEBUG(group->black_scanned_count = group->black_scanned_count + 1);
+    pthread_mutex_unlock(&(group->gray_lock));
+  }
+  push_mark_entry((BPTR) current, NULL, NULL);
+}
+#else
+static
+void RTmake_object_gray(GCPTR current) {
+  GPTR group = PTR_TO_GROUP(current);
+  link_gray_object(group, current);
+  assert(WHITEP(current));
+  SET_COLOR(current, GRAY);
+}
+#endif
+
 static inline int valid_interior_ptr(GCPTR gcptr, BPTR interior_ptr) {
   long delta = interior_ptr - (BPTR) gcptr;
   return(delta < (INTERIOR_PTR_RETENTION_LIMIT + sizeof(GC_HEADER)));
 }
 
+// The object index is the offset from the start of the run divided by
+// the group size, done as a multiply by the group's reciprocal. Pointers
+// into the leftover tail of a run map to the last object in the run.
+// Single object runs have no reciprocal and get their object straight
+// from page_bases.
 static inline GCPTR interior_to_gcptr_3(BPTR ptr, PPTR page, GPTR group) {
-  GCPTR gcptr;
-  if (group->size >= BYTES_PER_PAGE) {
-    gcptr = page->base;
-  } else {
-    // This only works because first_partition_ptr is BYTES_PER_PAGE aligned 
-    gcptr = (GCPTR) ((long) ptr & (-1 << group->index));
+  GCPTR gcptr = PAGE_INDEX_TO_RUN_BASE(page - pages, group);
+  if (group->size_reciprocal != 0) {
+    unsigned long offset = ptr - (BPTR) gcptr;
+    long index = (offset * group->size_reciprocal) >> SIZE_RECIPROCAL_SHIFT;
+    if (index >= group->run_objects) {
+      index = group->run_objects - 1;
+    }
+    gcptr = (GCPTR) ((BPTR) gcptr + (index * group->size));
   }
   return(gcptr);
 }
 
 static inline GCPTR interior_to_gcptr(BPTR ptr) {
   PPTR page = pages + PTR_TO_PAGE_INDEX(ptr);
-  GPTR group = page->group;
+  GPTR group = page_group_table[page->group_id];
   GCPTR gcptr;
 
   if (group > EXTERNAL_PAGE) {
-    if (group->size >= BYTES_PER_PAGE) {
-      gcptr = page->base;
-    } else {
-      // This only works because first_partition_ptr is BYTES_PER_PAGE aligned 
-      gcptr = (GCPTR) ((long) ptr & (-1 << group->index));
-    }
+    gcptr = interior_to_gcptr_3(ptr, page, group);
   } else {
     Debugger("ERROR! Found IN_HEAP pointer with NULL group!\n");
   }
@@ -119,10 +176,11 @@ static inline GCPTR interior_to_gcptr(BPTR ptr) {
 void RTtrace_pointer(void *ptr) {
   if (IN_PARTITION(ptr)) {
     PPTR page = pages + PTR_TO_PAGE_INDEX(ptr);
-    GPTR group = page->group;
+    GPTR group = page_group_table[page->group_id];
     if (group > EXTERNAL_PAGE) {
       GCPTR gcptr = interior_to_gcptr_3(ptr, page, group);
-      if (WHITEP(gcptr) && valid_interior_ptr(gcptr, ptr)) {
+      if (CARVED_OBJECT(gcptr, group) && UNMARKEDP(gcptr) &&
+	  valid_interior_ptr(gcptr, ptr)) {
 	RTmake_object_gray(gcptr);
       }
     }
@@ -133,48 +191,231 @@ void RTtrace_pointer(void *ptr) {
 // to point into the heap
 void RTtrace_heap_pointer(void *ptr) {
   GCPTR gcptr = interior_to_gcptr(ptr);
-  if (WHITEP(gcptr)) {
+  if (UNMARKEDP(gcptr)) {
     RTmake_object_gray(gcptr);
   }
 }
 
+#if USE_MARK_PREFETCH
+#if !USE_PARALLEL_MARKING
+#error "USE_MARK_PREFETCH needs USE_PARALLEL_MARKING"
+#endif
+// Each marker's carved objects waiting for their headers to arrive.
+// Objects stay carved until the cycle's garbage is recycled, so only
+// the color has to be checked later.
+static __thread GCPTR prefetch_fifo[MARK_PREFETCH_DISTANCE];
+static __thread int prefetch_head;	// oldest entry
+static __thread int prefetch_count;
+
+// Returns how many pointers were checked, their objects may have been
+// pushed on the marker's deque.
+int flush_mark_prefetch() {
+  int count = prefetch_count;
+  while (prefetch_count > 0) {
+    GCPTR gcptr = prefetch_fifo[prefetch_head];
+    prefetch_head = (prefetch_head + 1) & (MARK_PREFETCH_DISTANCE - 1);
+    prefetch_count = prefetch_count - 1;
+    if (UNMARKEDP(gcptr)) {
+      RTmake_object_gray(gcptr);
+    }
+  }
+  return(count);
+}
+#endif
+
+// gcptr is a carved object some scanned word points into
+static inline
+void trace_candidate(GCPTR gcptr) {
+#if USE_MARK_PREFETCH
+#if USE_MARK_BITMAP
+  __builtin_prefetch(MARK_BIT_PAIR(gcptr));
+#endif
+  __builtin_prefetch(gcptr);
+  if (prefetch_count < MARK_PREFETCH_DISTANCE) {
+    int tail = (prefetch_head + prefetch_count) & (MARK_PREFETCH_DISTANCE - 1);
+    prefetch_fifo[tail] = gcptr;
+    prefetch_count = prefetch_count + 1;
+    return;
+  }
+  GCPTR oldest = prefetch_fifo[prefetch_head];
+  prefetch_fifo[prefetch_head] = gcptr;
+  prefetch_head = (prefetch_head + 1) & (MARK_PREFETCH_DISTANCE - 1);
+  gcptr = oldest;
+#endif
+  if (UNMARKEDP(gcptr)) {
+    RTmake_object_gray(gcptr);
+  }
+}
+
+// Traces ptr if it's a *possible* pointer to a carved object
+static inline
+void scan_word(BPTR ptr) {
+  if (IN_PARTITION(ptr)) {
+    PPTR page = pages + PTR_TO_PAGE_INDEX(ptr);
+    GPTR group = page_group_table[page->group_id];
+    if (group > EXTERNAL_PAGE) {
+      GCPTR gcptr = interior_to_gcptr_3(ptr, page, group);
+      if (CARVED_OBJECT(gcptr, group) && valid_interior_ptr(gcptr, ptr)) {
+	trace_candidate(gcptr);
+      }
+    }
+  }
+}
+
+#if USE_SIMD_RANGE_SCAN
+// Most words in stacks, static space and pointer objects aren't heap
+// pointers at all. The kernels test RANGE_SCAN_BLOCK words at a time
+// against the partition and only hand the ones that might be in it to
+// the visitor, which still makes the exact IN_PARTITION check.
+#define RANGE_SCAN_BLOCK 8
+
+// Bit i is set if word i of the block is in the partition. The words
+// are biased by first_partition_ptr and compared unsigned, by flipping
+// their sign bits for the signed compare.
+static inline __attribute__((target("avx2")))
+unsigned int partition_mask_avx2(LPTR words) {
+  __m256i sign = _mm256_set1_epi64x(LONG_MIN);
+  __m256i first = _mm256_set1_epi64x((long) first_partition_ptr);
+  __m256i span = _mm256_set1_epi64x((last_partition_ptr - first_partition_ptr) ^
+				    LONG_MIN);
+  __m256i low = _mm256_loadu_si256((__m256i *) words);
+  __m256i high = _mm256_loadu_si256((__m256i *) (words + 4));
+  low = _mm256_xor_si256(_mm256_sub_epi64(low, first), sign);
+  high = _mm256_xor_si256(_mm256_sub_epi64(high, first), sign);
+  unsigned int low_mask =
+    _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(span, low)));
+  unsigned int high_mask =
+    _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(span, high)));
+  return(low_mask | (high_mask << 4));
+}
+
+// SSE2 has no 64 bit compare, so this only compares the high halves of
+// the biased words with the span's, which lets through a few words just
+// past the end of the partition.
+static inline
+unsigned int partition_mask_sse2(LPTR words) {
+  __m128i sign = _mm_set1_epi32(INT_MIN);
+  __m128i first = _mm_set1_epi64x((long) first_partition_ptr);
+  __m128i span = _mm_set1_epi32((int) ((unsigned long)
+				       (last_partition_ptr - first_partition_ptr) >> 32) ^
+				INT_MIN);
+  unsigned int mask = 0;
+  for (int i = 0; i < RANGE_SCAN_BLOCK; i = i + 2) {
+    __m128i biased = _mm_sub_epi64(_mm_loadu_si128((__m128i *) (words + i)), first);
+    __m128i above = _mm_cmpgt_epi32(_mm_xor_si128(biased, sign), span);
+    // movemask_pd takes bit 63 of each word, from the high half's compare
+    mask = mask | ((~_mm_movemask_pd(_mm_castsi128_pd(above)) & 3) << i);
+  }
+  return(mask);
+}
+
+static inline __attribute__((always_inline))
+void scan_words_with(BPTR low, BPTR high,
+		     unsigned int (*partition_mask)(LPTR words),
+		     void (*visit)(BPTR ptr)) {
+  LPTR next = (LPTR) low;
+  for (; (BPTR) (next + RANGE_SCAN_BLOCK) <= high;
+       next = next + RANGE_SCAN_BLOCK) {
+    unsigned int mask = (*partition_mask)(next);
+    while (0 != mask) {
+      (*visit)((BPTR) next[__builtin_ctz(mask)]);
+      mask = mask & (mask - 1);
+    }
+  }
+  for (; (BPTR) next < high; next = next + 1) {
+    (*visit)((BPTR) *next);
+  }
+}
+
+static __attribute__((target("avx2")))
+void scan_memory_segment_avx2(BPTR low, BPTR high) {
+  scan_words_with(low, high, partition_mask_avx2, scan_word);
+}
+
+static
+void scan_memory_segment_sse2(BPTR low, BPTR high) {
+  scan_words_with(low, high, partition_mask_sse2, scan_word);
+}
+
+// Scan memory to trace *possible* pointers
+static inline
+void scan_memory_segment(BPTR low, BPTR high) {
+  if ((high - low) < (RANGE_SCAN_BLOCK * GC_POINTER_ALIGNMENT)) {
+    for (BPTR next = low; next < high; next = next + GC_POINTER_ALIGNMENT) {
+      scan_word(*((BPTR *) next));
+    }
+  } else if (RANGE_SCAN_AVX2 == range_scan_kernel) {
+    scan_memory_segment_avx2(low, high);
+  } else {
+    scan_memory_segment_sse2(low, high);
+  }
+}
+
+// For rtbench, counts the words in the partition with one kernel, or
+// word by word for RANGE_SCAN_SCALAR.
+static long partition_word_count;
+
+static inline
+void count_partition_word(BPTR ptr) {
+  if (IN_PARTITION(ptr)) {
+    partition_word_count = partition_word_count + 1;
+  }
+}
+
+static __attribute__((target("avx2")))
+void count_partition_words_avx2(BPTR low, BPTR high) {
+  scan_words_with(low, high, partition_mask_avx2, count_partition_word);
+}
+
+long count_partition_words(BPTR low, BPTR high, int kernel) {
+  partition_word_count = 0;
+  if (RANGE_SCAN_AVX2 == kernel) {
+    count_partition_words_avx2(low, high);
+  } else if (RANGE_SCAN_SSE2 == kernel) {
+    scan_words_with(low, high, partition_mask_sse2, count_partition_word);
+  } else {
+    for (BPTR next = low; next < high; next = next + GC_POINTER_ALIGNMENT) {
+      count_partition_word(*((BPTR *) next));
+    }
+  }
+  return(partition_word_count);
+}
+
+static
+void init_range_scan() {
+  __builtin_cpu_init();
+  range_scan_kernel = __builtin_cpu_supports("avx2") ?
+    RANGE_SCAN_AVX2 : RANGE_SCAN_SSE2;
+  printf("Range scan: %s\n",
+	 (RANGE_SCAN_AVX2 == range_scan_kernel) ? "AVX2" : "SSE2");
+}
+#else
 // Scan memory to trace *possible* pointers
 static
 void scan_memory_segment(BPTR low, BPTR high) {
   for (BPTR next = low; next < high; next = next + GC_POINTER_ALIGNMENT) {
-    BPTR ptr = *((BPTR *) next);
-    if (IN_PARTITION(ptr)) {
-      PPTR page = pages + PTR_TO_PAGE_INDEX(ptr);
-      GPTR group = page->group;
-      if (group > EXTERNAL_PAGE) {
-	GCPTR gcptr = interior_to_gcptr_3(ptr, page, group);
-	if (WHITEP(gcptr) && valid_interior_ptr(gcptr, ptr)) {
-	  RTmake_object_gray(gcptr);
-	}
-      }
-    }
+    scan_word(*((BPTR *) next));
   }
 }
+#endif
 
+// Scans the whole md elements between low and high
 static
-void scan_memory_segment_with_metadata(BPTR low, BPTR high) {
-  LPTR last_ptr = (LPTR) high - 1;
-  RT_METADATA *md = (RT_METADATA *) *last_ptr;
+void scan_metadata_elements(BPTR low, BPTR high, RT_METADATA *md) {
   long size = *md;
-  long length = high - low - sizeof(RT_METADATA *);
-  long count = length / size;
+  long count = (high - low) / size;
 
-  for (int i = 0; i < count; i++) {
+  for (long i = 0; i < count; i++) {
     BPTR offset = low + (i * size);
     for (int j = 1; md[j] != -1; j++) {
       BPTR ptr = *((BPTR *) (offset + md[j]));
       if (IN_PARTITION(ptr)) {
 	PPTR page = pages + PTR_TO_PAGE_INDEX(ptr);
-	GPTR group = page->group;
+	GPTR group = page_group_table[page->group_id];
 	if (group > EXTERNAL_PAGE) {
 	  GCPTR gcptr = interior_to_gcptr_3(ptr, page, group);
-	  if (WHITEP(gcptr) && valid_interior_ptr(gcptr, ptr)) {
-	    RTmake_object_gray(gcptr);
+	  if (CARVED_OBJECT(gcptr, group) && valid_interior_ptr(gcptr, ptr)) {
+	    trace_candidate(gcptr);
 	  }
 	}
       }
@@ -182,25 +423,84 @@ void scan_memory_segment_with_metadata(BPTR low, BPTR high) {
   }
 }
 
+static
+void scan_memory_segment_with_metadata(BPTR low, BPTR high) {
+  LPTR last_ptr = (LPTR) high - 1;
+  scan_metadata_elements(low, (BPTR) last_ptr, (RT_METADATA *) *last_ptr);
+}
+
 // Public version
 void RTscan_memory_segment(BPTR low, BPTR high) {
   scan_memory_segment(low, high);
 }
 
-#if USE_BIT_WRITE_BARRIER
+#if USE_WRITE_VECTOR_SUMMARY
+// Scans the write vector words flagged in summary words first up to
+// end. Each word is taken whole with an exchange, and the barrier sets
+// a word's summary bit only after the word's bit, so anything marked
+// after its summary bit was taken is found on the next pass.
 static
-int scan_write_vector() {
+int scan_write_vector_range(long first, long end) {
+  int mark_count = 0;
+  for (long summary_index = first; summary_index < end; summary_index++) {
+    if (0 != write_vector_summary[summary_index]) {
+      unsigned long dirty =
+	locked_long_xchg(write_vector_summary + summary_index, 0);
+      while (0 != dirty) {
+	long index = (summary_index * BITS_PER_LONG) + __builtin_ctzl(dirty);
+	dirty = dirty & (dirty - 1);
+	unsigned long bits = locked_long_xchg(RTwrite_vector + index, 0);
+	BPTR base_ptr = first_partition_ptr +
+	  (index * OBJECT_ALIGNMENT * BITS_PER_LONG);
+	while (0 != bits) {
+	  int bit = __builtin_ctzl(bits);
+	  bits = bits & (bits - 1);
+	  GCPTR gcptr = (GCPTR) (base_ptr + (bit * OBJECT_ALIGNMENT));
+	  mark_count = mark_count + 1;
+	  if (UNMARKEDP(gcptr)) {
+	    RTmake_object_gray(gcptr);
+	  }
+	}
+      }
+    }
+  }
+  return(mark_count);
+}
+
+static inline
+long write_vector_scan_length() {
+  return(WRITE_SUMMARY_LENGTH(RTwrite_vector_length));
+}
+
+// The summary word is only written when its bit isn't set already, to
+// keep barrier stores from bouncing it between cores.
+static
+void mark_write_vector(GCPTR gcptr) {
+  long ptr_offset = ((BPTR) gcptr - first_partition_ptr);
+  long long_index = ptr_offset / (OBJECT_ALIGNMENT * BITS_PER_LONG);
+  int bit = (ptr_offset % (OBJECT_ALIGNMENT * BITS_PER_LONG)) / OBJECT_ALIGNMENT;
+  locked_long_or(RTwrite_vector + long_index, 1UL << bit);
+  LPTR summary = write_vector_summary + WRITE_SUMMARY_INDEX(long_index);
+  unsigned long summary_mask = 1UL << (long_index % BITS_PER_LONG);
+  if (0 == (*summary & summary_mask)) {
+    locked_long_or(summary, summary_mask);
+  }
+}
+#elif USE_BIT_WRITE_BARRIER
+// Scans write vector entries from first up to end
+static
+int scan_write_vector_range(long first, long end) {
   int mark_count = 0;
-  for (long index = 0; index < RTwrite_vector_length; index++) {
+  for (long index = first; index < end; index++) {
     if (0 != RTwrite_vector[index]) {
       BPTR base_ptr = first_partition_ptr + 
-	(index * MIN_GROUP_SIZE * BITS_PER_LONG);
+	(index * OBJECT_ALIGNMENT * BITS_PER_LONG);
       for (long bit = 0; bit < BITS_PER_LONG; bit = bit + 1) {
 	unsigned long mask = 1L << bit;
 	if (0 != (RTwrite_vector[index] & mask)) {
-	  GCPTR gcptr = (GCPTR) (base_ptr + (bit * MIN_GROUP_SIZE));
+	  GCPTR gcptr = (GCPTR) (base_ptr + (bit * OBJECT_ALIGNMENT));
 	  mark_count = mark_count + 1;
-	  if (WHITEP(gcptr)) {
+	  if (UNMARKEDP(gcptr)) {
 	    RTmake_object_gray(gcptr);
 	  }
 	  mask = ~mask;
@@ -215,25 +515,31 @@ int scan_write_vector() {
   return(mark_count);
 }
 
+static inline
+long write_vector_scan_length() {
+  return(RTwrite_vector_length);
+}
+
 static
 void mark_write_vector(GCPTR gcptr) {
   long ptr_offset = ((BPTR) gcptr - first_partition_ptr);
-  long long_index = ptr_offset / (MIN_GROUP_SIZE * BITS_PER_LONG);
-  int bit = (ptr_offset % (MIN_GROUP_SIZE * BITS_PER_LONG)) / MIN_GROUP_SIZE;
+  long long_index = ptr_offset / (OBJECT_ALIGNMENT * BITS_PER_LONG);
+  int bit = (ptr_offset % (OBJECT_ALIGNMENT * BITS_PER_LONG)) / OBJECT_ALIGNMENT;
   unsigned long bit_mask = 1L << bit;
   assert(0 != bit_mask);
   locked_long_or(RTwrite_vector + long_index, bit_mask);
 }
 #else
+// Scans write vector entries from first up to end
 static
-int scan_write_vector() {
+int scan_write_vector_range(long first, long end) {
   int mark_count = 0;
-  for (long index = 0; index < RTwrite_vector_length; index++) {
+  for (long index = first; index < end; index++) {
     if (1 == RTwrite_vector[index]) {
-      GCPTR gcptr = (GCPTR) (first_partition_ptr + (index * MIN_GROUP_SIZE));
+      GCPTR gcptr = (GCPTR) (first_partition_ptr + (index * OBJECT_ALIGNMENT));
       RTwrite_vector[index] = 0;
       mark_count = mark_count + 1;
-      if (WHITEP(gcptr)) {
+      if (UNMARKEDP(gcptr)) {
 	RTmake_object_gray(gcptr);
       }
     }
@@ -241,9 +547,14 @@ int scan_write_vector() {
   return(mark_count);
 }
 
+static inline
+long write_vector_scan_length() {
+  return(RTwrite_vector_length);
+}
+
 static
 void mark_write_vector(GCPTR gcptr) {
-  long index = ((BPTR) gcptr - first_partition_ptr) / MIN_GROUP_SIZE;
+  long index = ((BPTR) gcptr - first_partition_ptr) / OBJECT_ALIGNMENT;
   RTwrite_vector[index] = 1;
 }
 #endif
@@ -257,7 +568,7 @@ void *RTwrite_barrier(void *lhs_address, void *rhs) {
     BPTR object = *((BPTR *) lhs_address);
     if (IN_HEAP(object)) {
       GCPTR gcptr = interior_to_gcptr(object); 
-      if (WHITEP(gcptr) && valid_interior_ptr(gcptr, object)) {
+      if (UNMARKEDP(gcptr) && valid_interior_ptr(gcptr, object)) {
 	mark_write_vector(gcptr);
       }
     }
@@ -273,7 +584,7 @@ void *RTsafe_bash(void * lhs_address, void * rhs) {
     object = *((BPTR *) lhs_address);
     if (IN_HEAP(object)) {
       gcptr = interior_to_gcptr(object); 
-      if WHITEP(gcptr) {
+      if (UNMARKEDP(gcptr)) {
 	  Debugger("White object is escaping write_barrier!\n");
       }
     }
@@ -301,7 +612,7 @@ void memory_segment_write_barrier(BPTR low, BPTR high) {
       BPTR object = *((BPTR *) next);
       if (IN_HEAP(object)) {
 	GCPTR gcptr = interior_to_gcptr(object); 
-	if (WHITEP(gcptr) && valid_interior_ptr(gcptr, object)) {
+	if (UNMARKEDP(gcptr) && valid_interior_ptr(gcptr, object)) {
 	  mark_write_vector(gcptr);
 	}
       }
@@ -340,25 +651,38 @@ void scan_saved_stack(int i) {
   scan_memory_segment(ptr_aligned_top, bottom);
 }
 
+static
+void scan_saved_cache(int i) {
+  BPTR low = (BPTR) saved_threads[i].saved_cache_objects;
+  BPTR high = low + (saved_threads[i].saved_cache_count * sizeof(GCPTR));
+  scan_memory_segment(low, high);
+}
+
 static
 void scan_saved_thread_state(int i) {
   scan_saved_registers(i);
   scan_saved_stack(i);
+  scan_saved_cache(i);
 }
 
 static
-void scan_threads() {
-  for (int i = 0; i < total_saved_threads; i++) {
-    scan_saved_thread_state(i);
-  }  
-
-  // move this to it's own function
+void scan_no_write_barrier_state() {
   if (0 != saved_no_write_barrier_state) {
     BPTR low =  (BPTR) &saved_no_write_barrier_state;;
     BPTR high = ((BPTR) low + sizeof(long));
     scan_memory_segment(low, high);
   }
 }
+
+#if !USE_PARALLEL_MARKING
+static
+void scan_threads() {
+  for (int i = 0; i < total_saved_threads; i++) {
+    scan_saved_thread_state(i);
+  }  
+  scan_no_write_barrier_state();
+}
+#endif
   
 static
 void scan_global_roots() {
@@ -366,10 +690,11 @@ void scan_global_roots() {
     BPTR ptr =  *((BPTR *) *(global_roots + i));
     if (IN_PARTITION(ptr)) {
       PPTR page = pages + PTR_TO_PAGE_INDEX(ptr);
-      GPTR group = page->group;
+      GPTR group = page_group_table[page->group_id];
       if (group > EXTERNAL_PAGE) {
 	GCPTR gcptr = interior_to_gcptr_3(ptr, page, group); 
-	if (WHITEP(gcptr) && valid_interior_ptr(gcptr, ptr)) {
+	if (CARVED_OBJECT(gcptr, group) && UNMARKEDP(gcptr) &&
+	    valid_interior_ptr(gcptr, ptr)) {
 	  RTmake_object_gray(gcptr);
 	}
       }
@@ -377,20 +702,31 @@ void scan_global_roots() {
   }
 }
 
+// Only objects allocated before the flip are scanned. Later ones start
+// out empty, and anything stored in them is either allocated black or
+// was reachable from the snapshot anyway.
 static
 void scan_static_space() {
-  BPTR next = first_static_ptr;
-  // Ok to not acquire lock or copy at flip time???
-  // might scan uninitalized object or more than needed this way
-  // problaby safer to set static_frontier_at_flip in rtstop.c
-  BPTR end = static_frontier_ptr;
-  while (next < end) {
-    BPTR low = next + sizeof(long);
-    int size = *((long *) next);
-    size = size >> LINK_INFO_BITS;
-    next = low + size;
-    GCPTR gcptr = (GCPTR) (low - sizeof(GC_HEADER));
-    scan_object(gcptr, size + sizeof(GC_HEADER));
+  for (int i = 0; i < total_segments; i++) {
+    if (segments[i].type == STATIC_SEGMENT) {
+      BPTR next = segments[i].first_segment_ptr;
+      BPTR end = segments[i].flip_frontier_ptr;
+      while (next < end) {
+	volatile long *header = (volatile long *) next;
+	// Space taken before the flip whose allocator is still writing
+	// the header. The flip handler can have interrupted it there, but
+	// RTstatic_allocate only has a store or two left to do and never
+	// waits on the gc, so this lasts until it's next scheduled.
+	while (0 == *header) {
+	  sched_yield();
+	}
+	BPTR low = next + sizeof(long);
+	long size = *header >> LINK_INFO_BITS;
+	next = low + size;
+	GCPTR gcptr = (GCPTR) (low - sizeof(GC_HEADER));
+	scan_object(gcptr, size + sizeof(GC_HEADER));
+      }
+    }
   }
 }
 
@@ -417,6 +753,34 @@ void RTregister_no_write_barrier_state(void *start, int len) {
   RTno_write_barrier_state_ptr = start;
 }
 
+#if USE_PARALLEL_MARKING
+// Each marker takes every count'th saved thread, and the gc thread
+// takes the rest of the root set.
+static
+long scan_root_set_share(int marker, int count) {
+  for (int i = marker; i < total_saved_threads; i = i + count) {
+    scan_saved_thread_state(i);
+  }
+  if (0 == marker) {
+    scan_no_write_barrier_state();
+    scan_global_roots();
+    scan_static_space();
+    for (int i = 0; i < total_root_scanners; i++) {
+      (*root_scanners[i])();
+    }
+  }
+  return(0);
+}
+
+// Returns how many write vector entries were set in the marker's
+// share.
+static
+long scan_write_vector_share(int marker, int count) {
+  long length = write_vector_scan_length();
+  return(scan_write_vector_range((length * marker) / count,
+				 (length * (marker + 1)) / count));
+}
+#else
 static
 void scan_root_set() {
   scan_threads();
@@ -427,6 +791,12 @@ void scan_root_set() {
   }
 }
 
+static
+int scan_write_vector() {
+  return(scan_write_vector_range(0, write_vector_scan_length()));
+}
+#endif
+
 
 void scan_object(GCPTR ptr, int total_size) {
   BPTR bptr, low, high;
@@ -449,23 +819,113 @@ void scan_object(GCPTR ptr, int total_size) {
   }
 }
 
+// Exact size objects only need scanning up to their recorded size. The
+// size word is clamped because a mutator may be rewriting it.
+static inline
+int object_scan_size(GCPTR ptr, GPTR group) {
+#if USE_LARGE_OBJECT_SPACE
+  if (group == LARGE_GROUP) {
+    return(LARGE_OBJECT_SIZE(ptr));
+  }
+#endif
+#if USE_EXACT_OBJECT_SIZE
+  if (EXACT_SIZE_GROUP(group) && EXACT_SIZE_CLASS(GET_STORAGE_CLASS(ptr))) {
+    unsigned long body_size = *OBJECT_SIZE_WORD(ptr, group);
+    unsigned long max_body_size =
+      group->size - sizeof(GC_HEADER) - sizeof(long);
+    return(sizeof(GC_HEADER) + MIN(body_size, max_body_size));
+  }
+#endif
+  return(group->size);
+}
+
+#if USE_PARALLEL_MARKING
+// Splits the body into chunks for the deque. SC_METADATA chunks end on
+// element boundaries.
 static
-void scan_object_with_group(GCPTR ptr, GPTR group) {
-  scan_object(ptr, group->size);
+void push_object_chunks(GCPTR ptr, int total_size) {
+  BPTR low = (BPTR) ptr + sizeof(GC_HEADER);
+  BPTR high = (BPTR) ptr + total_size;
+  RT_METADATA *md = NULL;
+  long chunk_size = MARK_CHUNK_SIZE;
+
+  if (SC_METADATA == GET_STORAGE_CLASS(ptr)) {
+    high = high - sizeof(RT_METADATA *);
+    md = (RT_METADATA *) *((LPTR) high);
+    chunk_size = MAX(1, MARK_CHUNK_SIZE / *md) * *md;
+    high = low + (((high - low) / *md) * *md);
+  }
+  for (BPTR chunk = low; chunk < high; chunk = chunk + chunk_size) {
+    push_mark_entry(chunk, MIN(chunk + chunk_size, high), md);
+  }
+}
+
+// Objects are already marked when they go on a deque, so there's
+// nothing left to do to them but scan them. Returns the bytes scanned,
+// split objects count as their chunks are scanned.
+long scan_mark_entry(MARK_ENTRY *entry) {
+  if (NULL == entry->high) {
+    GCPTR ptr = (GCPTR) entry->low;
+    int total_size = object_scan_size(ptr, PTR_TO_GROUP(ptr));
+    int storage_class = GET_STORAGE_CLASS(ptr);
+    if ((total_size > MARK_CHUNK_SIZE) &&
+	((SC_POINTERS == storage_class) || (SC_METADATA == storage_class))) {
+      push_object_chunks(ptr, total_size);
+      return(0);
+    }
+    scan_object(ptr, total_size);
+    return(total_size);
+  }
+  if (NULL == entry->md) {
+    scan_memory_segment(entry->low, entry->high);
+  } else {
+    scan_metadata_elements(entry->low, entry->high, entry->md);
+  }
+  return(entry->high - entry->low);
+}
+
+// Markers never move a group's black pointer back over the gray set,
+// now that it's all been scanned it can go to the front in one step.
+static
+void finish_marking() {
+  for (int i = MIN_GROUP_INDEX; i <= LAST_GROUP_INDEX; i++) {
+    GPTR group = &groups[i];
+    if (group->gray != NULL) {
+      group->black = group->gray;
+    }
+  }
+}
+
+// Returns the bytes of heap objects scanned
+static
+long mark() {
+  run_mark_round(scan_root_set_share);
+  while (run_mark_round(scan_write_vector_share) > 0);
+  finish_marking();
+  return(take_marked_bytes());
+}
+#else
+static
+int scan_object_with_group(GCPTR ptr, GPTR group) {
+  int total_size = object_scan_size(ptr, group);
+  scan_object(ptr, total_size);
   SET_COLOR(ptr,marked_color);
   group->black = ptr;
   DEBUG(group->black_scanned_count = group->black_scanned_count + 1);
+  return(total_size);
 }
 
 // HEY! Fix this up now that it's not continuation based.
+// Returns the bytes scanned.
 static
-void scan_gray_set() {
+long scan_gray_set() {
   int i, scan_count, rescan_all_groups;
+  long scanned_bytes = 0;
 
   i = MIN_GROUP_INDEX;
   scan_count = 0;
   do {
-    while (i <= MAX_GROUP_INDEX) {
+    while (i <= LAST_GROUP_INDEX) {
       GPTR group = &groups[i];
       GCPTR current = group->black;
       // current could be gray, black, or green
@@ -473,7 +933,7 @@ void scan_gray_set() {
 	current = GET_LINK_POINTER(current->prev);
       }
       while (current != NULL) {
-	scan_object_with_group(current,group);
+	scanned_bytes = scanned_bytes + scan_object_with_group(current,group);
 	scan_count = scan_count + 1;
 	current = GET_LINK_POINTER(current->prev);
       }
@@ -487,14 +947,30 @@ void scan_gray_set() {
       rescan_all_groups = 0;
     }
   } while (rescan_all_groups == 1);
+  return(scanned_bytes);
 }
 
+// Returns the bytes of heap objects scanned
+static
+long mark() {
+  long scanned_bytes = 0;
+  scan_root_set();
+
+  int mark_count = 0;
+  do {
+    scanned_bytes = scanned_bytes + scan_gray_set();
+    mark_count = scan_write_vector();
+  } while (mark_count > 0);
+  return(scanned_bytes);
+}
+#endif
+
 static
 void flip() {
   assert(0 == enable_write_barrier);
   // No allocation allowed during a flip
   lock_all_free_locks();
-  for (int i = MIN_GROUP_INDEX; i <= MAX_GROUP_INDEX; i++) {
+  for (int i = MIN_GROUP_INDEX; i <= LAST_GROUP_INDEX; i++) {
     GPTR group = &groups[i];
     GCPTR free = group->free;
     if (free != NULL) {
@@ -511,6 +987,12 @@ void flip() {
       group->last = NULL;
     }
 
+#if USE_MARK_BITMAP
+    // The old black set is dropped, sweep_mark_bitmaps finds whatever
+    // in it turns out to be garbage.
+    group->white = NULL;
+    group->white_count = 0;
+#else
     // used to handle this with:
     // group->white = (GREENP(black) ? NULL : black)
     if (group->black == group->free) {
@@ -520,34 +1002,189 @@ void flip() {
     } else {
       group->white = group->black;
     }
-    group->black = group->free;
-    group->gray = NULL;
-
     group->white_count = group->black_scanned_count + group->black_alloc_count;
     assert(group->white_count >= 0);
+#endif
+    group->black = group->free;
+    group->gray = NULL;
 
     group->black_scanned_count = 0;
     group->black_alloc_count = 0;
   }
+#if USE_MARK_BITMAP
+  // Everything allocated so far is what this cycle marks from
+  mark_word = 1 - mark_word;
+#endif
 
   stop_all_mutators_and_save_state();
 }
 
+#if USE_GC_PREZEROING
+static inline
+void prezero_object(GCPTR gcptr, GPTR group) {
+  BPTR body = (BPTR) (gcptr + 1);
+  long body_size = group->size - sizeof(GC_HEADER);
+#if defined(__SSE2__)
+  if (body_size >= PREZERO_NONTEMPORAL_SIZE) {
+    // Bodies are 16 byte aligned and a multiple of 16 bytes long
+    __m128i zero = _mm_setzero_si128();
+    for (long i = 0; i < body_size; i = i + sizeof(__m128i)) {
+      _mm_stream_si128((__m128i *) (body + i), zero);
+    }
+  } else {
+    memset(body, 0, body_size);
+  }
+#else
+  memset(body, 0, body_size);
+#endif
+  SET_ZEROED(gcptr);
+}
+
+// Zero the garbage before recycle_group_garbage publishes it. White
+// objects are unreachable by now, so no lock is needed.
+static
+void prezero_group_garbage(GPTR group) {
+  if ((0 == DETECT_INVALID_REFS) && (group->size >= PREZERO_MIN_OBJECT_SIZE)) {
+    GCPTR next = group->white;
+    while (next != NULL) {
+      prezero_object(next, group);
+      next = GET_LINK_POINTER(next->next);
+    }
+#if defined(__SSE2__)
+    // Streaming stores must be visible before the free_lock unlock
+    _mm_sfence();
+#endif
+  }
+}
+#endif
+
+#if USE_DENSE_FIRST_ALLOCATION
+// Caller must hold the group->free_lock. Relinks the white list by
+// the occupancy of each object's run, fullest first, and returns its
+// new last object. Objects in runs that died keep the end of the list.
+static
+GCPTR sort_white_by_occupancy(GPTR group) {
+  GCPTR firsts[OCCUPANCY_BUCKETS];
+  GCPTR lasts[OCCUPANCY_BUCKETS];
+  GCPTR next = group->white;
+  memset(firsts, 0, sizeof(firsts));
+  memset(lasts, 0, sizeof(lasts));
+
+  while (next != NULL) {
+    GCPTR object = next;
+    next = GET_LINK_POINTER(next->next);
+    // A run with a white object in it can't be full
+    long live = RUN_LIVE_COUNT(PTR_TO_RUN_PAGE_INDEX(object));
+    int bucket = (OCCUPANCY_BUCKETS - 1) -
+      ((live * OCCUPANCY_BUCKETS) / group->run_objects);
+    if (lasts[bucket] == NULL) {
+      firsts[bucket] = object;
+    } else {
+      SET_LINK_POINTER(lasts[bucket]->next, object);
+      SET_LINK_POINTER(object->prev, lasts[bucket]);
+    }
+    lasts[bucket] = object;
+  }
+
+  GCPTR last = NULL;
+  group->white = NULL;
+  for (int i = 0; i < OCCUPANCY_BUCKETS; i++) {
+    if (firsts[i] != NULL) {
+      if (last == NULL) {
+	group->white = firsts[i];
+      } else {
+	SET_LINK_POINTER(last->next, firsts[i]);
+	SET_LINK_POINTER(firsts[i]->prev, last);
+      }
+      last = lasts[i];
+    }
+  }
+  return(last);
+}
+#endif
+
+// Caller must hold the group->free_lock. Splits the white list, which
+// ends at last, by the node its pages are on, and links each node's
+// objects in after that node's free objects, or after group->last if it
+// has none.
+static
+void link_white_by_node(GPTR group, GCPTR last) {
+  GCPTR firsts[MAX_NUMA_NODES];
+  GCPTR lasts[MAX_NUMA_NODES];
+  for (int node = 0; node < numa_node_count; node++) {
+    firsts[node] = NULL;
+    lasts[node] = NULL;
+  }
+
+  GCPTR next = group->white;
+  while (next != NULL) {
+    GCPTR object = next;
+    next = ((object == last) ? NULL : GET_LINK_POINTER(object->next));
+    int node = pages[PTR_TO_PAGE_INDEX(object)].node;
+    SET_LINK_POINTER(object->next, NULL);
+    if (firsts[node] == NULL) {
+      firsts[node] = object;
+      SET_LINK_POINTER(object->prev, NULL);
+    } else {
+      SET_LINK_POINTER(lasts[node]->next, object);
+      SET_LINK_POINTER(object->prev, lasts[node]);
+    }
+    lasts[node] = object;
+  }
+
+  for (int node = 0; node < numa_node_count; node++) {
+    GCPTR first = firsts[node];
+    if (first != NULL) {
+      GCPTR after = group->node_last[node];
+      if (after == NULL) {
+	after = group->last;
+	group->node_free[node] = first;
+	if (group->free == NULL) {
+	  group->free = first;
+	}
+	if (group->black == NULL) {
+	  group->black = first;
+	}
+      }
+      GCPTR before = ((after == NULL) ? NULL : GET_LINK_POINTER(after->next));
+      SET_LINK_POINTER(first->prev, after);
+      if (after != NULL) {
+	SET_LINK_POINTER(after->next, first);
+      }
+      SET_LINK_POINTER(lasts[node]->next, before);
+      if (before == NULL) {
+	group->last = lasts[node];
+      } else {
+	SET_LINK_POINTER(before->prev, lasts[node]);
+      }
+      group->node_last[node] = lasts[node];
+    }
+  }
+}
+
 // The alloc counterpart to this function is init_pages_for_group.
 // We need to change garbage color to green now so conservative
 // scanning in a later gc cycle doesn't start making free objects 
-// that look white turn gray!
+// that look white turn gray! Returns the number of bytes recycled.
 static
-void recycle_group_garbage(GPTR group) {
+long recycle_group_garbage(GPTR group) {
   int count = 0;
   GCPTR last = NULL;
   GCPTR next = group->white;
 
+#if USE_GC_PREZEROING
+  prezero_group_garbage(group);
+#endif
   pthread_mutex_lock(&(group->free_lock));
   while (next != NULL) {
     // Finalize code was here. Need to add it back
 
     SET_COLOR(next,GREEN);
+    long run_page = PTR_TO_RUN_PAGE_INDEX(next);
+    run_live_counts[run_page] = run_live_counts[run_page] - 1;
+    if (0 == run_live_counts[run_page]) {
+      queue_dead_run(run_page);
+    }
     if (DETECT_INVALID_REFS) {
       memset((BPTR) next + sizeof(GC_HEADER), 
 	     INVALID_ADDRESS,
@@ -563,7 +1200,14 @@ void recycle_group_garbage(GPTR group) {
     DEBUG(Debugger("group->white_count doesn't equal actual count\n"));
   }
 
-  if (last != NULL) {
+#if USE_DENSE_FIRST_ALLOCATION
+  if ((last != NULL) && (group->run_objects > 1)) {
+    last = sort_white_by_occupancy(group);
+  }
+#endif
+  if ((last != NULL) && (numa_node_count > 1)) {
+    link_white_by_node(group, last);
+  } else if (last != NULL) {
     SET_LINK_POINTER(last->next, NULL);
 
     if (group->free == NULL) {
@@ -584,29 +1228,112 @@ void recycle_group_garbage(GPTR group) {
   group->white = NULL;
   group->white_count = 0; // no lock needed, white_count is gc only
   pthread_mutex_unlock(&(group->free_lock));
+  return((long) count * group->size);
 }
 
+#if USE_LARGE_OBJECT_SPACE
+// Large garbage never goes on a free list. Its pages go straight back
+// into the holes.
+static
+void recycle_large_garbage(GPTR group) {
+  int count = 0;
+  GCPTR next = group->white;
+
+  pthread_mutex_lock(&(group->free_lock));
+  while (next != NULL) {
+    GCPTR garbage = next;
+    next = GET_LINK_POINTER(garbage->next);
+    int first_page = PTR_TO_PAGE_INDEX(garbage);
+    int page_count = LARGE_OBJECT_PAGES(LARGE_OBJECT_SIZE(garbage));
+    for (int i = first_page; i < (first_page + page_count); i++) {
+      SET_PAGE_GROUP(i, FREE_PAGE);
+    }
+    add_free_pages(first_page, page_count);
+    count = count + 1;
+  }
+  if (count != group->white_count) { 
+    DEBUG(printf("large white_count is %d, actual count is %d\n", 
+		 group->white_count, count));
+    DEBUG(Debugger("large white_count doesn't equal actual count\n"));
+  }
+  group->white = NULL;
+  group->white_count = 0; // no lock needed, white_count is gc only
+  pthread_mutex_unlock(&(group->free_lock));
+}
+#endif
+
+#if USE_MARK_BITMAP
+// Garbage is whatever had been allocated by the flip and wasn't marked.
+// It's found a bitmap word at a time and linked onto its group's white
+// list in address order, so the only objects whose headers get written
+// are the dead ones. Mutators are allocating again, but they only set
+// mark bits of objects that were free at the flip.
+static
+void sweep_mark_bitmaps() {
+  GCPTR lasts[LAST_GROUP_INDEX + 1];
+  long words = (total_partition_pages * MARK_BITS_BYTES_PER_PAGE) /
+    (2 * sizeof(long));
+
+  memset(lasts, 0, sizeof(lasts));
+  for (long index = 0; index < words; index++) {
+    LPTR pair = mark_bits + (2 * index);
+    unsigned long allocated = pair[1 - mark_word];
+    if (0 != allocated) {
+      unsigned long garbage = allocated & ~pair[mark_word];
+      pair[1 - mark_word] = 0;
+      BPTR base_ptr = first_partition_ptr +
+	(index * OBJECT_ALIGNMENT * BITS_PER_LONG);
+      while (0 != garbage) {
+	int bit = __builtin_ctzl(garbage);
+	garbage = garbage & (garbage - 1);
+	GCPTR gcptr = (GCPTR) (base_ptr + (bit * OBJECT_ALIGNMENT));
+	GPTR group = PTR_TO_GROUP(gcptr);
+	int i = group - groups;
+	SET_LINK_POINTER(gcptr->next, NULL);
+	SET_LINK_POINTER(gcptr->prev, lasts[i]);
+	if (lasts[i] == NULL) {
+	  group->white = gcptr;
+	} else {
+	  SET_LINK_POINTER(lasts[i]->next, gcptr);
+	}
+	lasts[i] = gcptr;
+	group->white_count = group->white_count + 1;
+      }
+    }
+  }
+}
+#endif
+
 static 
 void recycle_all_garbage() {
   assert(0 == enable_write_barrier);
+  long recycled_bytes = 0;
+#if USE_MARK_BITMAP
+  sweep_mark_bitmaps();
+#endif
   for (int i = MIN_GROUP_INDEX; i <= MAX_GROUP_INDEX; i++) {
-    recycle_group_garbage(&groups[i]);
+    recycled_bytes = recycled_bytes + recycle_group_garbage(&groups[i]);
   }
+#if USE_LARGE_OBJECT_SPACE
+  recycle_large_garbage(LARGE_GROUP);
+#endif
   coalesce_all_free_pages();
+  maybe_grow_heap(recycled_bytes);
 }
 
 static
 void full_gc() {
   flip();
   assert(1 == enable_write_barrier);
-  scan_root_set();
-
-  int mark_count = 0;
-  do {
-    scan_gray_set();
-    mark_count = scan_write_vector();
-  } while (mark_count > 0);
-
+  struct timeval start_tv, end_tv, mark_tv;
+  gettimeofday(&start_tv, 0);
+  total_mark_bytes = total_mark_bytes + mark();
+  gettimeofday(&end_tv, 0);
+  timersub(&end_tv, &start_tv, &mark_tv);
+  timeradd(&total_mark_tv, &mark_tv, &total_mark_tv);
+  if (timercmp(&mark_tv, &max_mark_tv, >)) {
+    max_mark_tv = mark_tv;
+  }
   enable_write_barrier = 0;
   recycle_all_garbage();
 
@@ -643,6 +1370,7 @@ void init_realtime_gc() {
 
   printf("Running last commit before t1/t2 branch creation\n");
   printf("Page size is %d\n", BYTES_PER_PAGE);
+  printf("NUMA nodes: %d\n", numa_node_count);
   printf((RTatomic_gc ? "***ATOMIC GC***\n" : "***REAL-TIME GC***\n"));
 #ifdef NDEBUG
   printf("NDEBUG is defined\n");
@@ -655,6 +1383,15 @@ void init_realtime_gc() {
   pthread_mutex_init(&static_frontier_ptr_lock, NULL);
   sem_init(&gc_semaphore, 0, 0);
   init_signals_for_rtgc();
+  init_coalescer();
+#if USE_PARALLEL_MARKING
+  init_markers();
+#endif
+#if USE_SIMD_RANGE_SCAN
+  init_range_scan();
+#endif
   timerclear(&max_flip_tv);
   timerclear(&total_flip_tv);
+  timerclear(&max_mark_tv);
+  timerclear(&total_mark_tv);
 }
@@ -34,12 +34,22 @@
 
 GROUP_INFO *groups;
 PAGE_INFO *pages;
-HOLE_PTR empty_pages;
+GCPTR *page_bases;
+int *run_live_counts;
+int *dead_runs;
+// init_group_info fills in the groups
+GPTR page_group_table[GROUP_IDS] = {EMPTY_PAGE, FREE_PAGE,
+				     SYSTEM_PAGE, EXTERNAL_PAGE};
+HOLE_PTR empty_pages[HOLE_BINS];
+unsigned long empty_bin_bits[HOLE_BIN_WORDS];
+// No hole in the bin with unreleased pages is older than this
+long empty_bin_oldest[HOLE_BINS];
+long empty_page_count;
 
 int RTpage_power = PAGE_POWER;
-int RTpage_size = BYTES_PER_PAGE;  
+int RTpage_size = 1 << PAGE_POWER;
 SEGMENT *segments;
-int total_segments;
+volatile int total_segments;
 
 THREAD_INFO *threads;
 THREAD_INFO *live_threads;
@@ -53,9 +63,7 @@ char **global_roots;
 int total_global_roots;
 
 // HEY! only 1 static segment while these are global!
-BPTR first_static_ptr;
-BPTR last_static_ptr;
-BPTR static_frontier_ptr;
+volatile int current_static_segment = -1;
 
 BPTR first_partition_ptr;
 BPTR last_partition_ptr;
@@ -66,6 +74,13 @@ LPTR RTwrite_vector;
 BPTR RTwrite_vector;
 #endif
 size_t RTwrite_vector_length;
+#if USE_WRITE_VECTOR_SUMMARY
+LPTR write_vector_summary;
+#endif
+#if USE_MARK_BITMAP
+LPTR mark_bits;
+int mark_word = 0;
+#endif
 
 long total_partition_pages;
 int unmarked_color;
@@ -84,6 +99,22 @@ pthread_mutex_t static_frontier_ptr_lock;
 sem_t gc_semaphore;
 volatile int run_gc = 0;
 volatile int RTatomic_gc = 0;
+size_t RTheap_reserve_bytes = DEFAULT_HEAP_RESERVE_BYTES;
+int RTrelease_min_pages = DEFAULT_RELEASE_MIN_PAGES;
+int RTrelease_age = DEFAULT_RELEASE_AGE;
+int RTrelease_use_madv_free = 0;  // MADV_FREE instead of MADV_DONTNEED
+int RTuse_huge_pages = 0;
+int RTnuma_nodes = 0;		// 0 asks the kernel
+int numa_node_count = 1;
+int RTlock_memory = 0;
+int RTmarker_threads = 1;
+int marker_count = 1;
+#if USE_SIMD_RANGE_SCAN
+int range_scan_kernel = 0;
+#endif
+long total_mark_bytes = 0;
+struct timeval total_mark_tv;
+struct timeval max_mark_tv;
 
 long *RTno_write_barrier_state_ptr = 0;
 long saved_no_write_barrier_state = 0;
@@ -0,0 +1,458 @@
+/*
+ * Copyright 2017 Wade Lawrence Hennessey
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+// rtgc parallel marking
+//
+// The gc thread is marker 0 and marks in rounds, one for the root set
+// and one for each pass over the write vector. At the start of a round
+// it wakes the helper markers, every marker scans its share of the
+// round's seed work, and they all drain their deques, stealing from
+// each other, until none of them has anything left.
+//
+// The deques are Chase-Lev work stealing deques. The owner pushes and
+// pops at the bottom without locking, thieves take from the top with a
+// compare and swap, and the only race is for the last entry.
+//
+// With more than one NUMA node, helper markers are spread over the
+// nodes, and objects found on another node's pages are handed to that
+// node's inbox for its markers to scan. A marker looks for work on its
+// own node before taking any from another.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <pthread.h>
+#include <signal.h>
+#include "mem-config.h"
+#include "info-bits.h"
+#include "mem-internals.h"
+#include "allocate.h"
+
+#if USE_PARALLEL_MARKING
+
+typedef struct marker {
+  volatile long top;		// next entry a thief takes
+  long top_pad[7];		// keeps thieves off the owner's cache line
+  volatile long bottom;		// next free entry, only the owner moves it
+  MARK_ENTRY volatile *deque;	// MARK_DEQUE_SIZE entries
+  MARK_ENTRY *overflow;		// owner only, when the deque is full
+  long overflow_count;
+  long overflow_size;
+  long seed_count;		// what the round's seed returned
+  long marked_bytes;		// scanned since take_marked_bytes
+  int index;
+  int node;			// NUMA node whose pages it prefers
+  MARK_ENTRY *handoffs[MAX_NUMA_NODES];	// owner only, for other nodes
+  int handoff_counts[MAX_NUMA_NODES];
+  long bottom_pad[2];
+} MARKER;
+
+static MARKER *markers;
+
+typedef struct mark_inbox {
+  pthread_mutex_t lock;
+  volatile long count;
+  long size;
+  MARK_ENTRY *entries;
+} MARK_INBOX;
+
+static MARK_INBOX inboxes[MAX_NUMA_NODES];
+static int node_marker_counts[MAX_NUMA_NODES];
+// Set when there are markers on more than one node
+static int numa_marking = 0;
+
+static __thread MARKER *this_marker;
+
+static pthread_mutex_t mark_round_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mark_round_cond = PTHREAD_COND_INITIALIZER;
+static long mark_round = 0;
+static long (*mark_round_seed)(int marker, int count);
+static volatile unsigned long busy_markers;
+static volatile unsigned long finished_helpers;
+
+static
+void spill_entry(MARKER *marker, BPTR low, BPTR high, long *md) {
+  if (marker->overflow_count == marker->overflow_size) {
+    marker->overflow_size = MAX(MARK_DEQUE_SIZE, 2 * marker->overflow_size);
+    marker->overflow = realloc(marker->overflow,
+			       marker->overflow_size * sizeof(MARK_ENTRY));
+    if (NULL == marker->overflow) {
+      out_of_memory("Mark stack", marker->overflow_size * sizeof(MARK_ENTRY));
+    }
+  }
+  MARK_ENTRY *entry = marker->overflow + marker->overflow_count;
+  entry->low = low;
+  entry->high = high;
+  entry->md = md;
+  marker->overflow_count = marker->overflow_count + 1;
+}
+
+// The entry and bottom are volatile, and x86 doesn't reorder stores, so
+// a thief that sees the new bottom sees the whole entry.
+static inline
+void push_entry(MARKER *marker, BPTR low, BPTR high, long *md) {
+  long bottom = marker->bottom;
+  if ((bottom - marker->top) >= MARK_DEQUE_SIZE) {
+    spill_entry(marker, low, high, md);
+  } else {
+    MARK_ENTRY volatile *entry =
+      marker->deque + (bottom & (MARK_DEQUE_SIZE - 1));
+    entry->low = low;
+    entry->high = high;
+    entry->md = md;
+    marker->bottom = bottom + 1;
+  }
+}
+
+// Moves the marker's entries for node to the node's inbox
+static
+void flush_handoffs(MARKER *marker, int node) {
+  int count = marker->handoff_counts[node];
+  if (0 == count) {
+    return;
+  }
+  MARK_INBOX *inbox = inboxes + node;
+  pthread_mutex_lock(&(inbox->lock));
+  if ((inbox->count + count) > inbox->size) {
+    inbox->size = MAX(MARK_DEQUE_SIZE, 2 * (inbox->count + count));
+    inbox->entries = realloc(inbox->entries, inbox->size * sizeof(MARK_ENTRY));
+    if (NULL == inbox->entries) {
+      out_of_memory("Mark inbox", inbox->size * sizeof(MARK_ENTRY));
+    }
+  }
+  memcpy(inbox->entries + inbox->count, marker->handoffs[node],
+	 count * sizeof(MARK_ENTRY));
+  inbox->count = inbox->count + count;
+  pthread_mutex_unlock(&(inbox->lock));
+  marker->handoff_counts[node] = 0;
+}
+
+static
+void hand_off_entry(MARKER *marker, int node, BPTR low, BPTR high, long *md) {
+  int count = marker->handoff_counts[node];
+  MARK_ENTRY *entry = marker->handoffs[node] + count;
+  entry->low = low;
+  entry->high = high;
+  entry->md = md;
+  marker->handoff_counts[node] = count + 1;
+  if ((count + 1) == MARK_HANDOFF_SIZE) {
+    flush_handoffs(marker, node);
+  }
+}
+
+// Whole objects on pages of a node with markers of its own go to them
+void push_mark_entry(BPTR low, BPTR high, long *md) {
+  MARKER *marker = this_marker;
+  if (numa_marking && (NULL == high)) {
+    int node = pages[PTR_TO_PAGE_INDEX(low)].node;
+    if ((node != marker->node) && (node_marker_counts[node] > 0)) {
+      hand_off_entry(marker, node, low, high, md);
+      return;
+    }
+  }
+  push_entry(marker, low, high, md);
+}
+
+static inline
+void copy_entry(MARK_ENTRY volatile *from, MARK_ENTRY *to) {
+  to->low = from->low;
+  to->high = from->high;
+  to->md = from->md;
+}
+
+static
+int pop_entry(MARKER *marker, MARK_ENTRY *entry) {
+  long bottom = marker->bottom - 1;
+  marker->bottom = bottom;
+  // A thief has to see the smaller bottom before we look at top
+  if (marker_count > 1) {
+    memory_fence();
+  }
+  long top = marker->top;
+  if (top > bottom) {
+    marker->bottom = top;
+    return(0);
+  }
+  copy_entry(marker->deque + (bottom & (MARK_DEQUE_SIZE - 1)), entry);
+  if (top < bottom) {
+    return(1);
+  }
+  // Last entry, whoever moves top gets it
+  int won = locked_long_cas(&(marker->top), top, top + 1);
+  marker->bottom = top + 1;
+  return(won);
+}
+
+// Refills the deque from the overflow stack once it's empty, so the
+// spilled work can be stolen too.
+static
+int pop_work(MARKER *marker, MARK_ENTRY *entry) {
+  if (pop_entry(marker, entry)) {
+    return(1);
+  }
+  if (0 == marker->overflow_count) {
+    return(0);
+  }
+  long count = MIN(marker->overflow_count, MARK_DEQUE_SIZE / 2);
+  for (long i = 0; i < count; i++) {
+    marker->overflow_count = marker->overflow_count - 1;
+    MARK_ENTRY *spilled = marker->overflow + marker->overflow_count;
+    push_entry(marker, spilled->low, spilled->high, spilled->md);
+  }
+  return(pop_entry(marker, entry));
+}
+
+static
+int steal_entry(MARKER *victim, MARK_ENTRY *entry) {
+  long top = victim->top;
+  long bottom = victim->bottom;
+  if (top >= bottom) {
+    return(0);
+  }
+  copy_entry(victim->deque + (top & (MARK_DEQUE_SIZE - 1)), entry);
+  return(locked_long_cas(&(victim->top), top, top + 1));
+}
+
+// Only steals from markers on the thief's node when same_node is set
+static
+int steal_work(MARKER *thief, MARK_ENTRY *entry, int same_node) {
+  for (int i = 1; i < marker_count; i++) {
+    MARKER *victim = markers + ((thief->index + i) % marker_count);
+    if ((!same_node || (victim->node == thief->node)) &&
+	steal_entry(victim, entry)) {
+      return(1);
+    }
+  }
+  return(0);
+}
+
+// Moves up to half a deque's worth of the node's inbox onto the
+// marker's deque. Returns 0 if the inbox was empty.
+static
+int take_inbox(MARKER *marker, int node) {
+  MARK_INBOX *inbox = inboxes + node;
+  if (0 == inbox->count) {
+    return(0);
+  }
+  pthread_mutex_lock(&(inbox->lock));
+  long count = MIN(inbox->count, MARK_DEQUE_SIZE / 2);
+  for (long i = 0; i < count; i++) {
+    inbox->count = inbox->count - 1;
+    MARK_ENTRY *entry = inbox->entries + inbox->count;
+    push_entry(marker, entry->low, entry->high, entry->md);
+  }
+  pthread_mutex_unlock(&(inbox->lock));
+  return(count > 0);
+}
+
+// Called with the marker's own deque empty. Work on the marker's node
+// comes first, its inbox and then its node's markers, then any other
+// marker, and last the other nodes' inboxes. The marker's handoffs are
+// flushed first, so it only fails once every inbox was seen empty.
+static
+int find_work(MARKER *marker, MARK_ENTRY *entry) {
+  if (numa_marking) {
+    for (int node = 0; node < numa_node_count; node++) {
+      flush_handoffs(marker, node);
+    }
+    if (take_inbox(marker, marker->node)) {
+      return(pop_work(marker, entry));
+    }
+    if (steal_work(marker, entry, 1)) {
+      return(1);
+    }
+  }
+  if (steal_work(marker, entry, 0)) {
+    return(1);
+  }
+  if (numa_marking) {
+    for (int node = 0; node < numa_node_count; node++) {
+      if (take_inbox(marker, node)) {
+	return(pop_work(marker, entry));
+      }
+    }
+  }
+  return(0);
+}
+
+static
+int work_to_steal(MARKER *thief) {
+  for (int i = 1; i < marker_count; i++) {
+    MARKER *victim = markers + ((thief->index + i) % marker_count);
+    if (victim->top < victim->bottom) {
+      return(1);
+    }
+  }
+  if (numa_marking) {
+    for (int node = 0; node < numa_node_count; node++) {
+      if (inboxes[node].count > 0) {
+	return(1);
+      }
+    }
+  }
+  return(0);
+}
+
+static inline
+void scan_entry(MARKER *marker, MARK_ENTRY *entry) {
+  marker->marked_bytes = marker->marked_bytes + scan_mark_entry(entry);
+}
+
+// A marker only stops being busy with its deque empty and nothing in
+// hand, its prefetched pointers and handoffs included, and a thief is
+// busy again before it takes anything, so once busy_markers is zero
+// there's no gray work left anywhere.
+static
+void mark_until_done(MARKER *marker) {
+  MARK_ENTRY entry;
+  while (1) {
+    if (pop_work(marker, &entry)) {
+      scan_entry(marker, &entry);
+#if USE_MARK_PREFETCH
+    } else if (flush_mark_prefetch() > 0) {
+      continue;
+#endif
+    } else if (find_work(marker, &entry)) {
+      scan_entry(marker, &entry);
+    } else {
+      locked_long_dec(&busy_markers);
+      while (1) {
+	if (0 == busy_markers) {
+	  return;
+	}
+	if (work_to_steal(marker)) {
+	  locked_long_inc(&busy_markers);
+	  if (find_work(marker, &entry)) {
+	    scan_entry(marker, &entry);
+	    break;
+	  }
+	  locked_long_dec(&busy_markers);
+	}
+	sched_yield();
+      }
+    }
+  }
+}
+
+// Helper markers aren't RTpthreads, flips don't have to stop them
+// since they only run inside a round. They stay on their node's cpus.
+static
+void *marker_loop(void *arg) {
+  MARKER *marker = (MARKER *) arg;
+  long round = 0;
+  this_marker = marker;
+  if (numa_marking) {
+    RTbind_thread_to_numa_node(marker->node);
+  }
+  while (1) {
+    pthread_mutex_lock(&mark_round_lock);
+    while (round == mark_round) {
+      pthread_cond_wait(&mark_round_cond, &mark_round_lock);
+    }
+    round = mark_round;
+    pthread_mutex_unlock(&mark_round_lock);
+    marker->seed_count = (*mark_round_seed)(marker->index, marker_count);
+    mark_until_done(marker);
+    locked_long_inc(&finished_helpers);
+  }
+  return(NULL);
+}
+
+// Runs on the gc thread. Returns the total of what each marker's seed
+// returned, after all the gray work they found has been scanned.
+long run_mark_round(long (*seed)(int marker, int count)) {
+  this_marker = markers;
+  mark_round_seed = seed;
+  busy_markers = marker_count;
+  finished_helpers = 0;
+  if (marker_count > 1) {
+    pthread_mutex_lock(&mark_round_lock);
+    mark_round = mark_round + 1;
+    pthread_cond_broadcast(&mark_round_cond);
+    pthread_mutex_unlock(&mark_round_lock);
+  }
+  markers[0].seed_count = (*seed)(0, marker_count);
+  mark_until_done(markers);
+  while (finished_helpers < (marker_count - 1)) {
+    sched_yield();
+  }
+  long total = 0;
+  for (int i = 0; i < marker_count; i++) {
+    total = total + markers[i].seed_count;
+  }
+  return(total);
+}
+
+// Bytes of heap objects the markers have scanned since the last call.
+// Only called between rounds.
+long take_marked_bytes() {
+  long total = 0;
+  for (int i = 0; i < marker_count; i++) {
+    total = total + markers[i].marked_bytes;
+    markers[i].marked_bytes = 0;
+  }
+  return(total);
+}
+
+// The gc thread, marker 0, isn't bound to a node, it just counts as
+// node 0's.
+void init_markers() {
+  marker_count = RTmarker_threads;
+  markers = RTbig_malloc(sizeof(MARKER) * marker_count);
+  numa_marking = (marker_count > 1) && (numa_node_count > 1);
+  for (int node = 0; node < MAX_NUMA_NODES; node++) {
+    pthread_mutex_init(&(inboxes[node].lock), NULL);
+    inboxes[node].count = 0;
+    inboxes[node].size = 0;
+    inboxes[node].entries = NULL;
+    node_marker_counts[node] = 0;
+  }
+  for (int i = 0; i < marker_count; i++) {
+    MARKER *marker = markers + i;
+    marker->top = 0;
+    marker->bottom = 0;
+    marker->deque = RTbig_malloc(sizeof(MARK_ENTRY) * MARK_DEQUE_SIZE);
+    marker->overflow = NULL;
+    marker->overflow_count = 0;
+    marker->overflow_size = 0;
+    marker->seed_count = 0;
+    marker->marked_bytes = 0;
+    marker->index = i;
+    marker->node = i % numa_node_count;
+    node_marker_counts[marker->node] = node_marker_counts[marker->node] + 1;
+    for (int node = 0; node < MAX_NUMA_NODES; node++) {
+      marker->handoffs[node] = NULL;
+      marker->handoff_counts[node] = 0;
+      if (numa_marking && (node < numa_node_count)) {
+	marker->handoffs[node] =
+	  RTbig_malloc(sizeof(MARK_ENTRY) * MARK_HANDOFF_SIZE);
+      }
+    }
+  }
+  for (int i = 1; i < marker_count; i++) {
+    pthread_t thread;
+    if (0 != pthread_create(&thread, NULL, &marker_loop, markers + i)) {
+      Debugger("marker thread create failed!\n");
+    }
+  }
+  printf("Marker threads: %d\n", marker_count);
+}
+
+#endif
@@ -88,6 +88,25 @@ void print_registers(gregset_t *gregs) {
   printf("REG_CR2 %llx\n", (*gregs)[REG_CR2]);
 }
 
+#if USE_THREAD_CACHES
+// Cached objects were allocated black last cycle and are white after
+// this flip. Nothing but the cache points at them, so the cache contents
+// become part of this thread's saved root state.
+static
+void save_thread_caches(THREAD_INFO *thread, THREAD_STATE *state) {
+  int saved = 0;
+  for (int i = MIN_GROUP_INDEX; i <= MAX_GROUP_INDEX; i++) {
+    THREAD_CACHE *cache = &(thread->caches[i]);
+    int count = cache->count;
+    for (int j = 0; j < count; j++) {
+      state->saved_cache_objects[saved] = cache->objects[j];
+      saved = saved + 1;
+    }
+  }
+  state->saved_cache_count = saved;
+}
+#endif
+
 void gc_flip_action_func(int signum, siginfo_t *siginfo, void *context) {
   THREAD_INFO *thread;
   struct timeval start_tv, end_tv, pause_tv;
@@ -117,6 +136,9 @@ void gc_flip_action_func(int signum, siginfo_t *siginfo, void *context) {
 	   stack_top,
 	   live_stack_size);
     saved_threads[thread->saved_thread_index].saved_stack_size = live_stack_size;
+#if USE_THREAD_CACHES
+    save_thread_caches(thread, &(saved_threads[thread->saved_thread_index]));
+#endif
     locked_long_inc(&copied_stack_count);
 
     gettimeofday(&end_tv, 0);
@@ -154,14 +176,14 @@ void init_signals_for_rtgc() {
 }
 
 void lock_all_free_locks() {
-  for (int i = MIN_GROUP_INDEX; i <= MAX_GROUP_INDEX; i++) {
+  for (int i = MIN_GROUP_INDEX; i <= LAST_GROUP_INDEX; i++) {
     GPTR group = &groups[i];
     pthread_mutex_lock(&(group->free_lock));
   }
 }
 
 void unlock_all_free_locks() {
-  for (int i = MIN_GROUP_INDEX; i <= MAX_GROUP_INDEX; i++) {
+  for (int i = MIN_GROUP_INDEX; i <= LAST_GROUP_INDEX; i++) {
     GPTR group = &groups[i];
     pthread_mutex_unlock(&(group->free_lock));
   }
@@ -178,6 +200,7 @@ int stop_all_mutators_and_save_state() {
   while (thread != NULL) {
     thread->saved_thread_index = total_threads_to_halt;
     saved_threads[total_threads_to_halt].saved_stack_size = 0;
+    saved_threads[total_threads_to_halt].saved_cache_count = 0;
       
     total_threads_to_halt = total_threads_to_halt + 1;
     int err = pthread_kill(thread->pthread, FLIP_SIGNAL);
@@ -201,6 +224,15 @@ int stop_all_mutators_and_save_state() {
   while (entered_handler_count != total_threads_to_halt) {
     sched_yield();
   }
+  // Mutators leave the flip handler as soon as their state is copied,
+  // so they may already be bumping static frontiers again and this
+  // copy can be past the real flip point. Frontiers only move up, so
+  // it still covers every static object allocated before the flip. The
+  // newer ones it takes in just get scanned too, which can only retain
+  // more than needed.
+  for (int i = 0; i < total_segments; i++) {
+    segments[i].flip_frontier_ptr = segments[i].frontier_ptr;
+  }
   
   enable_write_barrier = 1;
   SWAP(marked_color,unmarked_color);
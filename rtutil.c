@@ -15,6 +15,8 @@
  *
  */
 
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -24,26 +26,229 @@
 #include <unistd.h>
 #include <sys/mman.h>
 #include <sys/time.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <pthread.h>
+#include <sched.h>
 #include "mem-config.h"
 #include "info-bits.h"
 #include "mem-internals.h"
 #include "allocate.h"
 
+// With RTlock_memory everything the gc allocates or commits is faulted
+// in and locked, so neither allocation nor the gc ever takes a page
+// fault on it. Memory that can't be locked counts as a failed commit.
+static
+int lock_memory(void *ptr, size_t bytes) {
+  if ((0 != RTlock_memory) && (0 != mlock(ptr, bytes))) {
+    printf("Couldn't lock %ld bytes, RLIMIT_MEMLOCK may be too low\n",
+	   bytes);
+    return(0);
+  }
+  return(1);
+}
+
 // grows *DOWN*, not up
 void *RTbig_malloc(size_t bytes) {
   BPTR p = (mmap(0,
 		 bytes,
-		 PROT_EXEC | PROT_READ | PROT_WRITE,
-		 MAP_PRIVATE | MAP_ANONYMOUS,
-		 0,
+		 PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS |
+		 ((0 != RTlock_memory) ? MAP_POPULATE : 0),
+		 -1,
 		 0));
+  if ((p != MAP_FAILED) && !lock_memory(p, bytes)) {
+    munmap(p, bytes);
+    p = NULL;
+  }
   // printf("RTbig_malloc of %ld bytes returning pointer %p\n", bytes, p);
   return(p);
 }
 
+static
+BPTR reserve_address_space(void *ptr, size_t bytes, int flags) {
+  void *p = mmap(ptr,
+		 bytes,
+		 PROT_NONE,
+		 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | flags,
+		 -1,
+		 0);
+  return((p == MAP_FAILED) ? NULL : p);
+}
+
+// Address space only, RTcommit_memory makes pieces of it usable. With
+// huge pages the reservation is huge page aligned and sized, so
+// committing whole huge pages never runs off the end of it.
+void *RTreserve_memory(size_t bytes) {
+  if (0 == RTuse_huge_pages) {
+    return(reserve_address_space(0, bytes, 0));
+  }
+  bytes = ROUND_UP_TO_HUGE_PAGE(bytes);
+  BPTR p = reserve_address_space(0, bytes + HUGE_PAGE_BYTES, 0);
+  if (NULL != p) {
+    BPTR aligned = (BPTR) ROUND_UP_TO_HUGE_PAGE(p);
+    if (aligned > p) {
+      munmap(p, aligned - p);
+    }
+    munmap(aligned + bytes, (p + HUGE_PAGE_BYTES) - aligned);
+    madvise(aligned, bytes, MADV_HUGEPAGE);
+    p = aligned;
+  }
+  return(p);
+}
+
+// With huge pages this commits every huge page the range touches, so
+// the kernel can back all of it with huge pages.
+int RTcommit_memory(void *ptr, size_t bytes) {
+  if (0 != RTuse_huge_pages) {
+    BPTR low = (BPTR) ROUND_DOWN_TO_HUGE_PAGE(ptr);
+    bytes = ROUND_UP_TO_HUGE_PAGE((BPTR) ptr + bytes) - (long) low;
+    ptr = low;
+  }
+  return((0 == mprotect(ptr, bytes, PROT_READ | PROT_WRITE)) &&
+	 lock_memory(ptr, bytes));
+}
+
+// The heap is committed in disjoint huge page multiples when huge pages
+// are on, so it can be remapped from the hugetlb pool. If the pool
+// can't cover it we put the reservation back and use transparent huge
+// pages instead.
+int RTcommit_heap_memory(void *ptr, size_t bytes) {
+#ifdef MAP_HUGETLB
+  if ((RThugetlb_pages == RTuse_huge_pages) &&
+      (0 == ((long) ptr & HUGE_PAGE_ALIGNMENT_MASK)) &&
+      (0 == (bytes & HUGE_PAGE_ALIGNMENT_MASK))) {
+    void *p = mmap(ptr,
+		   bytes,
+		   PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB,
+		   -1,
+		   0);
+    if (p == ptr) {
+      return(lock_memory(ptr, bytes));
+    }
+    if (NULL == reserve_address_space(ptr, bytes, MAP_FIXED)) {
+      return(0);
+    }
+    madvise(ptr, bytes, MADV_HUGEPAGE);
+  }
+#endif
+  return(RTcommit_memory(ptr, bytes));
+}
+
+// One more than the highest node in the kernel's online list, which is
+// a set of ranges like "0" or "0-1,3". 1 if there's no NUMA support.
+int RTonline_numa_nodes() {
+  int nodes = 1;
+  char list[256];
+  FILE *file = fopen("/sys/devices/system/node/online", "r");
+  if (file != NULL) {
+    if (NULL != fgets(list, sizeof(list), file)) {
+      int node = 0;
+      for (char *next = list; *next != '\0'; next++) {
+	if (isdigit(*next)) {
+	  node = (node * 10) + (*next - '0');
+	  nodes = MAX(nodes, node + 1);
+	} else {
+	  node = 0;
+	}
+      }
+    }
+    fclose(file);
+  }
+  return(nodes);
+}
+
+// The node of the cpu the calling thread is on right now. It may have
+// moved by the time the caller uses it, which only costs locality.
+int RTcurrent_numa_node() {
+  unsigned int node = 0;
+  if ((numa_node_count > 1) && (0 == getcpu(NULL, &node))) {
+    return(node % numa_node_count);
+  }
+  return(0);
+}
+
+// Pages already in memory move to the node, the rest fault in there.
+// Failure just leaves the pages wherever the kernel puts them.
+void RTbind_to_numa_node(void *ptr, size_t bytes, int node) {
+  unsigned long mask = 1UL << node;
+  syscall(SYS_mbind, ptr, bytes, MPOL_PREFERRED, &mask,
+	  BITS_PER_LONG, MPOL_MF_MOVE);
+}
+
+// Restricts the calling thread to the cpus in the node's cpulist, which
+// is a set of ranges like "0-3,8-11". Returns 0 if the list can't be
+// read or the kernel refuses, leaving the thread where it was.
+int RTbind_thread_to_numa_node(int node) {
+  char path[64];
+  char list[1024];
+  cpu_set_t cpus;
+  int cpu_count = 0;
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist",
+	   node);
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    return(0);
+  }
+  CPU_ZERO(&cpus);
+  if (NULL != fgets(list, sizeof(list), file)) {
+    char *next = list;
+    while (isdigit(*next)) {
+      int first = strtol(next, &next, 10);
+      int last = first;
+      if ('-' == *next) {
+	last = strtol(next + 1, &next, 10);
+      }
+      for (int cpu = first; (cpu <= last) && (cpu < CPU_SETSIZE); cpu++) {
+	CPU_SET(cpu, &cpus);
+	cpu_count = cpu_count + 1;
+      }
+      if (',' == *next) {
+	next = next + 1;
+      }
+    }
+  }
+  fclose(file);
+  return((cpu_count > 0) && (0 == sched_setaffinity(0, sizeof(cpus), &cpus)));
+}
+
+// The process's locked memory, VmLck in /proc/self/status. With
+// RTlock_memory that's the gc's whole footprint, plus whatever else the
+// process locked itself.
+long RTlocked_bytes() {
+  long locked_kb = 0;
+  char line[256];
+  FILE *file = fopen("/proc/self/status", "r");
+  if (file != NULL) {
+    while (NULL != fgets(line, sizeof(line), file)) {
+      if (1 == sscanf(line, "VmLck: %ld kB", &locked_kb)) {
+	break;
+      }
+    }
+    fclose(file);
+  }
+  return(locked_kb * 1024);
+}
+
+// How much of [ptr, ptr + bytes) is actually in memory, ptr must be
+// OS page aligned.
+long RTresident_bytes(void *ptr, size_t bytes) {
+  long page_count = (bytes + OS_PAGE_BYTES - 1) / OS_PAGE_BYTES;
+  unsigned char *resident = malloc(page_count);
+  long resident_count = 0;
+  if ((resident != NULL) && (0 == mincore(ptr, bytes, resident))) {
+    for (long i = 0; i < page_count; i++) {
+      resident_count = resident_count + (resident[i] & 1);
+    }
+  }
+  free(resident);
+  return(resident_count * OS_PAGE_BYTES);
+}
+
 void out_of_memory(char *msg, int bytes_needed) {
   printf("out of memory %s %d\n", msg, bytes_needed);
   Debugger(0);
@@ -145,11 +350,9 @@ int verify_white_count(GPTR group) {
   GCPTR ptr = group->white;
   int count = 0;
   while (ptr != NULL) {
-    if (group->size < BYTES_PER_PAGE) {
-      if ((((long) (GET_LINK_POINTER(ptr->prev)) % group->size) != 0) ||
-	  (((long) (GET_LINK_POINTER(ptr->next)) % group->size) != 0)) {
-	Debugger("Bad gchdr\n");
-      }
+    if ((((long) (GET_LINK_POINTER(ptr->prev)) % OBJECT_ALIGNMENT) != 0) ||
+	(((long) (GET_LINK_POINTER(ptr->next)) % OBJECT_ALIGNMENT) != 0)) {
+      Debugger("Bad gchdr\n");
     }
     ptr = GET_LINK_POINTER(ptr->next);
     count = count + 1;
@@ -161,7 +364,7 @@ int verify_white_count(GPTR group) {
 
 static
 void verify_white_counts() {
-  for (int i = MIN_GROUP_INDEX; i <= MAX_GROUP_INDEX; i++) {
+  for (int i = MIN_GROUP_INDEX; i <= LAST_GROUP_INDEX; i++) {
     GPTR group = &groups[i];
     verify_white_count(group);
   }